@@ -4,232 +4,200 @@
  * This file is the starter project for the BASIC interpreter.
  */
 
-#include <cctype>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include <string>
-#include "exp.hpp"
-#include "parser.hpp"
-#include "program.hpp"
+#include "allocstats.hpp"
+#include "bytecode.hpp"
+#include "jit.hpp"
+#include "loader.hpp"
+#include "optimizer.hpp"
+#include "profiler.hpp"
+#include "server.hpp"
+#include "session.hpp"
+#include "threaded.hpp"
+#include "value.hpp"
 #include "Utils/error.hpp"
-#include "Utils/tokenScanner.hpp"
-#include "Utils/strlib.hpp"
 
-/* Function prototypes */
+/* Number of threads LOAD parses with; 0 lets the loader decide */
 
-void processLine(std::string line, Program &program, EvalState &state);
+static int loadJobs = 0;
 
-/* Main program */
+/*
+ * Function: reportAllocationsAtExit
+ * ---------------------------------
+ * Writes the allocation counts to standard error when the interpreter
+ * exits, whether through QUIT, the end of its input or a program file.
+ * Registered only in builds that count allocations.
+ */
 
-int main() {
-   // freopen("../Test/trace87.txt","r",stdin);
-    // freopen("class_code/Homework/Basic-Interpreter-main/Test/trace07.txt","r",stdin);
-    // freopen("class_code/Homework/Basic-Interpreter-main/Basic/0.out","w",stdout);
-    EvalState state;
-    Program program;
-    //cout << "Stub implementation of BASIC" << endl;
-    while (true) {
-        try {
-            std::string input;
-            getline(std::cin, input);
-            if (input.empty())
-                return 0;
-            processLine(input, program, state);
-        } catch (ErrorException &ex) {
-            std::cout << ex.getMessage() << std::endl;
-        }
-    }
-    return 0;
+static void reportAllocationsAtExit() {
+    std::cerr << allocationReport();
 }
 
+/* Main program */
+
 /*
- * Function: processLine
- * Usage: processLine(line, program, state);
- * -----------------------------------------
- * Processes a single line entered by the user.  In this version of
- * implementation, the program reads a line, parses it as an expression,
- * and then prints the result.  In your implementation, you will
- * need to replace this method with one that can respond correctly
- * when the user enters a program line (which begins with a number)
- * or one of the BASIC commands, such as LIST or RUN.
+ * Command-line options:
+ *
+ *   --tree                 Evaluate statements with the tree interpreter
+ *                          instead of the bytecode virtual machine (for
+ *                          differential testing).
+ *   --no-optimize          Do not simplify expressions after parsing.
+ *   --no-threaded          Run programs one statement at a time instead
+ *                          of compiling them into threaded code.
+ *   --no-jit               Never compile hot loops into machine code.
+ *   --int64                Use 64-bit values and report INTEGER OVERFLOW
+ *                          instead of wrapping around at 32 bits.
+ *   --output-buffer=BYTES  Buffer up to BYTES of output before writing;
+ *                          0 writes every line immediately.  By default
+ *                          output is buffered unless stdout is a terminal.
+ *   --jobs=N               Parse loaded programs on N threads (default:
+ *                          chosen from the program size).
+ *   --profile              After each run, report per-line execution
+ *                          counts, taken branches and time on stderr.
+ *   --profile-folded=FILE  After each run, write the profile to FILE as
+ *                          folded stacks for flame graph tools.
+ *   --server=PATH          Listen on the Unix domain socket PATH and
+ *                          give every connection a session of its own
+ *                          instead of reading commands from stdin.
+ *                          Profiling is not available in this mode.
+ *   --workers=N            Run server sessions on N threads (default:
+ *                          one per CPU).
+ *   --step-budget=N        Suspend a running program after N backward
+ *                          jumps; CONT resumes it for another N.
+ *   --time-budget=MS       Suspend a running program after MS
+ *                          milliseconds.  In server mode the budgets
+ *                          are time slices: a suspended session is
+ *                          resumed after the other sessions have run.
+ *                          Server slices last 10 ms unless MS is given.
+ *   FILE                   Load the program in FILE, run it and exit,
+ *                          instead of reading commands from stdin.
  */
 
+static void usage(const char *progname) {
+    std::cerr << "usage: " << progname
+              << " [--tree] [--no-optimize] [--no-threaded] [--no-jit] [--int64]"
+              << " [--output-buffer=BYTES] [--jobs=N] [--profile]"
+              << " [--profile-folded=FILE] [--server=PATH] [--workers=N]"
+              << " [--step-budget=N] [--time-budget=MS] [FILE]" << std::endl;
+    exit(1);
+}
 
-void processLine(std::string line, Program &program, EvalState &state) {
-    TokenScanner scanner;
-    scanner.ignoreWhitespace();
-    scanner.scanNumbers();
-    scanner.setInput(line);
-
-    std::string it1=scanner.nextToken();
-    int lineNumber;
-    Statement* stmt;
-    std::string token;
-    if(!isNumeric(it1)){
-        lineNumber = -1;
-        token = it1;
-    }
-    else {
-        lineNumber = std::stoi(it1);
-        //错误：处理只输入了一个数字的情况
-        if(line==it1) {
-            if (program.exist_line.find(lineNumber) != program.exist_line.end()
-                || program.processed_line.find(lineNumber) != program.processed_line.end()) {
-                program.original_line.erase(lineNumber);
-                program.exist_line.erase(lineNumber);
-                delete program.processed_line[lineNumber];
-                program.processed_line.erase(lineNumber);//错误：要 erase
-            }
-            //错误：return要放在里层if的外面
-            return;
-        }
-        if(program.processed_line.find(lineNumber) != program.processed_line.end()){
-            if(program.original_line[lineNumber]=="10 PRINT 1"){
-                program.processed_line[lineNumber]->erase_print();
-            }
+int main(int argc, char **argv) {
+    long outputBuffer = -1;
+    const char *file = nullptr;
+    const char *socketPath = nullptr;
+    ServerOptions options;
+    long long stepBudget = 0;
+    long long timeBudget = 0;
+    Profiler profiler;
+    bool profile = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--tree") == 0) {
+            useBytecode = false;
+        } else if (std::strcmp(argv[i], "--no-optimize") == 0) {
+            useOptimizer = false;
+        } else if (std::strcmp(argv[i], "--no-threaded") == 0) {
+            useThreaded = false;
+        } else if (std::strcmp(argv[i], "--no-jit") == 0) {
+            useJit = false;
+        } else if (std::strcmp(argv[i], "--int64") == 0) {
+            useInt64 = true;
+        } else if (std::strncmp(argv[i], "--output-buffer=", 16) == 0) {
+            char *end;
+            outputBuffer = std::strtol(argv[i] + 16, &end, 10);
+            if (*end != '\0' || outputBuffer < 0) usage(argv[0]);
+        } else if (std::strncmp(argv[i], "--jobs=", 7) == 0) {
+            char *end;
+            long jobs = std::strtol(argv[i] + 7, &end, 10);
+            if (*end != '\0' || jobs < 1 || jobs > 1024) usage(argv[0]);
+            loadJobs = int(jobs);
+        } else if (std::strcmp(argv[i], "--profile") == 0) {
+            profiler.setReport(true);
+            profile = true;
+        } else if (std::strncmp(argv[i], "--profile-folded=", 17) == 0 && argv[i][17] != '\0') {
+            profiler.setFoldedFile(argv[i] + 17);
+            profile = true;
+        } else if (std::strncmp(argv[i], "--server=", 9) == 0 && argv[i][9] != '\0') {
+            socketPath = argv[i] + 9;
+        } else if (std::strncmp(argv[i], "--workers=", 10) == 0) {
+            char *end;
+            long n = std::strtol(argv[i] + 10, &end, 10);
+            if (*end != '\0' || n < 1 || n > 1024) usage(argv[0]);
+            options.workers = int(n);
+        } else if (std::strncmp(argv[i], "--step-budget=", 14) == 0) {
+            char *end;
+            stepBudget = std::strtoll(argv[i] + 14, &end, 10);
+            if (*end != '\0' || stepBudget < 1) usage(argv[0]);
+        } else if (std::strncmp(argv[i], "--time-budget=", 14) == 0) {
+            char *end;
+            timeBudget = std::strtoll(argv[i] + 14, &end, 10);
+            if (*end != '\0' || timeBudget < 1) usage(argv[0]);
+        } else if (argv[i][0] != '-' && file == nullptr) {
+            file = argv[i];
+        } else {
+            usage(argv[0]);
         }
-        program.addSourceLine(lineNumber,line);
-        stmt = nullptr;
-        token = scanner.nextToken();
     }
-    
-    // 根据不同类型的标记进行处理
-    if (token == "LET") {
-        std::string str_in = scanner.nextToken();
-        scanner.nextToken();
-        Expression* expression = parseExp(scanner);
-
-        //注意如果没有定义，那么会输出 VARIABLE NOT DEFINED
-        //错误：value_in不能放在外面，应该放在里面，只能传入expression*
-
-        stmt = new LET(str_in,expression);
-        if(lineNumber==-1){
-            try{
-                stmt->execute(state,program);
-                delete stmt;
-            }
-            catch(...){delete stmt;throw;}//错误：要接收
-            return;
-        }
-    } else if (token == "PRINT") {
-        Expression* expression3 = parseExp(scanner);
-        stmt = new PRINT(expression3);
-        if(lineNumber==-1){
-            try{
-                stmt->execute(state,program);
-                delete stmt;
-                delete expression3;
-            }
-            catch(...){
-                delete stmt;
-                delete expression3;
-                throw;
-            }
-            return;
+   // freopen("../Test/trace87.txt","r",stdin);
+    // freopen("class_code/Homework/Basic-Interpreter-main/Test/trace07.txt","r",stdin);
+    // freopen("class_code/Homework/Basic-Interpreter-main/Basic/0.out","w",stdout);
+    if (countingAllocations) std::atexit(reportAllocationsAtExit);
+    if (socketPath != nullptr) {
+        if (file != nullptr || profile) usage(argv[0]);
+        options.loadJobs = loadJobs;
+        options.stepBudget = stepBudget;
+        options.timeBudget = std::chrono::milliseconds(timeBudget);
+        return runServer(socketPath, options);
+    }
+    Session session;
+    session.setLoadJobs(loadJobs);
+    session.setBudget(stepBudget, std::chrono::milliseconds(timeBudget));
+    EvalState &state = session.getState();
+    Program &program = session.getProgram();
+    if (profile) program.setProfiler(&profiler);
+    if (outputBuffer == 0) {
+        state.output().setBuffered(false);
+    } else if (outputBuffer > 0) {
+        state.output().setBuffered(true);
+        state.output().setThreshold(outputBuffer);
+    }
+    if (file != nullptr) {
+        try {
+            loadProgram(file, program, state, loadJobs);
+            program.run(state);
+        } catch (ErrorException &ex) {
+            state.output() << ex.getMessage() << '\n';
+            state.output().flush();
+            return 1;
+        } catch (...) {
+            state.output().flush();
+            throw;
         }
-    } else if (token == "INPUT") {
-        std::string variable = scanner.nextToken();
-        stmt = new INPUT(variable);
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            return;
+        if (program.isSuspended()) {
+            state.output() << "BREAK IN " << program.suspendedLine() << '\n';
+            state.output().flush();
+            return 1;
         }
-    } else if (token == "RUN") {
-        auto it=program.exist_line.begin();
-        while(it!=program.exist_line.end()){
-            program.processed_line[*it]->execute(state,program);
-            if(program.whether_stop==true) {
-                //错误：要重置 whether_stop
-                program.whether_stop= false;
+        state.output().flush();
+        return 0;
+    }
+    //cout << "Stub implementation of BASIC" << endl;
+    // 解释器错误以外的异常（例如 stoi 越界）仍会终止进程，但先把缓冲的输出写出去
+    try {
+        while (!session.finished()) {
+            std::string input;
+            getline(std::cin, input);
+            if (input.empty())
                 break;
-            }
-            if(program.current_line!=0){
-                it = program.exist_line.find(program.current_line);
-                program.current_line=0;
-                //错误：continue不能漏
-                continue;
-            }
-            it++;
-        }
-//        stmt = new RUN();
-//        stmt->execute(state,program);
-//        delete stmt;
-        return;
-    } else if (token == "END") {
-        stmt = new END();
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            return;
-        }
-    } else if (token == "GOTO") {
-        std::string str1=scanner.nextToken();
-        int value_in=std::stoi(str1);
-        stmt = new GOTO(value_in);
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            return;
-        }
-    } else if (token == "LIST") {
-        stmt = new LIST();
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            return;
-        }
-    } else if (token == "REM") {
-        // 错误：这里只要构造一个REM就行，不用再进行其他操作
-        stmt = new REM ();
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            std::cout<<"SYNTAX ERROR"<<std::endl;
-            return;
-        }
-    } else if (token == "IF") {
-        // int pos=line.find_first_of("=<>");
-        // std::string str1=line.substr(0,pos-1);
-
-        Expression* a = readE(scanner,1);
-        std::string str= scanner.nextToken();
-        Expression* b = readE(scanner,1);
-        scanner.nextToken();
-        Expression* c = readE(scanner);
-        int line_in = c->eval(state);
-        delete c;
-        //错误：这里使用了 readE，而 readE里面没有释放内存，所以要自己去释放内存
-        //错误：在传入时只能传入Expression*类型的，因为不然可能还没有创建这个变量
-        stmt = new IF (a, b, str, line_in);
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            return;
-        }
-    } else if (token == "QUIT") {
-        stmt = new QUIT();
-        if(lineNumber==-1){
-            delete stmt;
-            exit(0);
-        }
-    } else if (token == "HELP") {
-        stmt = new HELP();
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            return;
-        }
-    } else if (token == "CLEAR") {
-        stmt = new CLEAR;
-        if(lineNumber==-1){
-            stmt->execute(state,program);
-            delete stmt;
-            return;
+            session.processLine(input);
         }
+    } catch (...) {
+        state.output().flush();
+        throw;
     }
-
-    // 将解析后的语句存储到容器中
-
-    program.setParsedStatement(lineNumber,stmt);
+    state.output().flush();
+    return 0;
 }
-
@@ -8,6 +8,7 @@
 #include "error.hpp"
 #include "tokenScanner.hpp"
 #include "strlib.hpp"
+#include "../allocstats.hpp"
 
 
 TokenScanner::TokenScanner() {
@@ -26,14 +27,7 @@ TokenScanner::TokenScanner(std::istream &infile) {
 }
 
 TokenScanner::~TokenScanner() {
-    delete isp;
-    //delete savedTokens chain
-    StringCell *pre = savedTokens;
-    while (savedTokens) {
-        savedTokens = savedTokens->link;
-        delete pre;
-        pre = savedTokens;
-    }
+    clearSavedTokens();
     //delete operators chain
     StringCell *p = operators;
     while (operators) {
@@ -43,90 +37,142 @@ TokenScanner::~TokenScanner() {
     }
 }
 
+/*
+ * Implementation notes: setInput, setInputView
+ * --------------------------------------------
+ * String input is scanned in place through a string_view; only input
+ * streams are read character by character through isp.  The scanner
+ * never owns isp, which always points to a stream supplied by the
+ * client.
+ */
+
 void TokenScanner::setInput(std::string str) {
-    buffer = str;
-    if (isp != nullptr) delete isp;
-    isp = new std::istringstream(buffer);
-    delete savedTokens;
-    savedTokens = nullptr;
+    AllocScope scope(ALLOC_SCANNER);
+    buffer = std::move(str);
+    setInputView(buffer);
 }
 
 void TokenScanner::setInput(std::istream &infile) {
-    if (isp != nullptr)delete isp;
     isp = &infile;
-    delete savedTokens;
-    savedTokens = nullptr;
+    viewMode = false;
+    view = std::string_view();
+    pos = 0;
+    clearSavedTokens();
+}
+
+void TokenScanner::setInputView(std::string_view line) {
+    isp = nullptr;
+    viewMode = true;
+    view = line;
+    pos = 0;
+    eofSeen = false;
+    clearSavedTokens();
 }
 
 bool TokenScanner::hasMoreTokens() {
-    std::string token = nextToken();
-    saveToken(token);
-    return (token != "");
+    return peekToken().type != TokenType(EOF);
 }
 
 std::string TokenScanner::nextToken() {
-    if (savedTokens != nullptr) {
-        StringCell *cp = savedTokens;
-        std::string token = cp->str;
-        savedTokens = cp->link;
-        delete cp;
-        return token;
+    AllocScope scope(ALLOC_SCANNER);
+    if (savedCount > 0) {
+        return std::string(popSaved().text);
+    }
+    if (viewMode) {
+        return std::string(scanTokenView().text);
     }
     while (true) {
         if (ignoreWhitespaceFlag) skipSpaces();
-        int ch = isp->get();
+        int ch = get();
         if (ch == '/' && ignoreCommentsFlag) {
-            ch = isp->get();
+            ch = get();
             if (ch == '/') {
                 while (true) {
-                    ch = isp->get();
+                    ch = get();
                     if (ch == '\n' || ch == '\r' || ch == EOF) break;
                 }
                 continue;
             } else if (ch == '*') {
                 int prev = EOF;
                 while (true) {
-                    ch = isp->get();
+                    ch = get();
                     if (ch == EOF || (prev == '*' && ch == '/')) break;
                     prev = ch;
                 }
                 continue;
             }
-            if (ch != EOF) isp->unget();
+            if (ch != EOF) unget();
             ch = '/';
         }
         if (ch == EOF) return "";
         if ((ch == '"' || ch == '\'') && scanStringsFlag) {
-            isp->unget();
+            unget();
             return scanString();
         }
         if (isdigit(ch) && scanNumbersFlag) {
-            isp->unget();
+            unget();
             return scanNumber();
         }
         if (isWordCharacter(ch)) {
-            isp->unget();
+            unget();
             return scanWord();
         }
         std::string op = std::string(1, ch);
         while (isOperatorPrefix(op)) {
-            ch = isp->get();
+            ch = get();
             if (ch == EOF) break;
             op += ch;
         }
         while (op.length() > 1 && !isOperator(op)) {
-            isp->unget();
+            unget();
             op.erase(op.length() - 1, 1);
         }
         return op;
     }
 }
 
+/*
+ * Implementation notes: nextTokenView
+ * -----------------------------------
+ * A saved token is returned as it was stored.  In view mode a new token
+ * is scanned directly from the input and returned as a view of it; a
+ * token read from a stream is copied into the scanner-owned string
+ * current.
+ */
+
+TokenScanner::Token TokenScanner::nextTokenView() {
+    if (savedCount > 0) return popSaved();
+    if (viewMode) return scanTokenView();
+    current = nextToken();
+    return {current, typeOf(current)};
+}
+
 void TokenScanner::saveToken(std::string token) {
-    StringCell *cp = new StringCell;
-    cp->str = token;
-    cp->link = savedTokens;
-    savedTokens = cp;
+    pushSaved(token, typeOf(token), true);
+}
+
+/*
+ * Implementation notes: saveToken
+ * -------------------------------
+ * A token that is a view of the input stays valid for as long as the
+ * input does, so it is saved without copying.  Any other token (an
+ * empty end-of-input token or one that refers to scanner storage) is
+ * copied into the ring buffer entry.
+ */
+
+void TokenScanner::saveToken(const Token &token) {
+    bool inView = false;
+    if (viewMode && !token.text.empty()) {
+        const char *begin = view.data();
+        const char *end = begin + view.size();
+        inView = token.text.data() >= begin && token.text.data() + token.text.size() <= end;
+    }
+    pushSaved(token.text, token.type, !inView);
+}
+
+TokenScanner::Token TokenScanner::peekToken() {
+    if (savedCount == 0) saveToken(nextTokenView());
+    return {saved[savedHead].text, saved[savedHead].type};
 }
 
 void TokenScanner::ignoreWhitespace() {
@@ -146,10 +192,12 @@ void TokenScanner::scanStrings() {
 }
 
 void TokenScanner::addWordCharacters(std::string str) {
+    AllocScope scope(ALLOC_SCANNER);
     wordChars += str;
 }
 
 void TokenScanner::addOperator(std::string op) {
+    AllocScope scope(ALLOC_SCANNER);
     StringCell *cp = new StringCell;
     cp->str = op;
     cp->link = operators;
@@ -157,10 +205,14 @@ void TokenScanner::addOperator(std::string op) {
 }
 
 int TokenScanner::getPosition() const {
-    if (savedTokens == nullptr) {
+    if (viewMode) {
+        if (savedCount == 0) return int(pos);
+        return int(pos) - int(saved[savedHead].text.length());
+    }
+    if (savedCount == 0) {
         return int(isp->tellg());
     } else {
-        return int(isp->tellg()) - savedTokens->str.length();
+        return int(isp->tellg()) - int(saved[savedHead].text.length());
     }
     return -1;
 }
@@ -179,7 +231,11 @@ void TokenScanner::verifyToken(std::string expected) {
 };
 
 TokenType TokenScanner::getTokenType(std::string token) const {
-    if (token == "") return TokenType(EOF);
+    return typeOf(token);
+}
+
+TokenType TokenScanner::typeOf(std::string_view token) const {
+    if (token.empty()) return TokenType(EOF);
     char ch = token[0];
     if (isspace(ch)) return SEPARATOR;
     if (ch == '"' || (ch == '\'' && token.length() > 1)) return STRING;
@@ -264,16 +320,153 @@ std::string TokenScanner::getStringValue(std::string token) const {
 }
 
 int TokenScanner::getChar() {
-    return isp->get();
+    return get();
 }
 
-void TokenScanner::ungetChar(int ch) {
-    isp->unget();
+void TokenScanner::ungetChar(int) {
+    unget();
 }
 
 /* Private methods */
 
+/*
+ * Implementation notes: get, unget
+ * --------------------------------
+ * These methods read and push back one character from whichever
+ * source is active, so that the scanning code can be shared by both
+ * modes.  Once an istream has reported end of file, unget no longer
+ * has any effect, and the view mimics that so that both modes split
+ * input such as "10E" identically.
+ */
+
+int TokenScanner::get() {
+    if (viewMode) {
+        if (pos >= view.size()) {
+            eofSeen = true;
+            return EOF;
+        }
+        return (unsigned char) view[pos++];
+    }
+    return isp->get();
+}
+
+void TokenScanner::unget() {
+    if (viewMode) {
+        if (!eofSeen && pos > 0) pos--;
+    } else {
+        isp->unget();
+    }
+}
+
+/*
+ * Implementation notes: saved tokens
+ * ----------------------------------
+ * The saved tokens form a stack that lives in a fixed ring buffer:
+ * pushing moves savedHead back one entry and popping moves it forward,
+ * so no memory is allocated once the entries' storage has warmed up.
+ */
+
+void TokenScanner::clearSavedTokens() {
+    savedCount = 0;
+}
+
+void TokenScanner::pushSaved(std::string_view text, TokenType type, bool copy) {
+    AllocScope scope(ALLOC_SCANNER);
+    if (savedCount == SAVED_TOKEN_CAPACITY) {
+        error("TokenScanner: too many saved tokens");
+    }
+    savedHead = (savedHead + SAVED_TOKEN_CAPACITY - 1) % SAVED_TOKEN_CAPACITY;
+    savedCount++;
+    SavedToken &entry = saved[savedHead];
+    if (copy) {
+        entry.storage.assign(text.data(), text.size());
+        entry.text = entry.storage;
+    } else {
+        entry.text = text;
+    }
+    entry.type = type;
+}
+
+TokenScanner::Token TokenScanner::popSaved() {
+    SavedToken &entry = saved[savedHead];
+    savedHead = (savedHead + 1) % SAVED_TOKEN_CAPACITY;
+    savedCount--;
+    return {entry.text, entry.type};
+}
+
+/*
+ * Implementation notes: scanTokenView
+ * -----------------------------------
+ * This method follows the same rules as nextToken but records where
+ * each token starts and ends instead of building a string.  Numbers
+ * are recognized by the same state machine, scanNumber.  When that
+ * machine backs up over a dangling exponent marker (as in "9E."), the
+ * token it returns still includes the marker, so in that one case the
+ * returned text is the copy rather than the view.
+ */
+
+TokenScanner::Token TokenScanner::scanTokenView() {
+    while (true) {
+        if (ignoreWhitespaceFlag) skipSpaces();
+        std::size_t start = pos;
+        int ch = get();
+        if (ch == '/' && ignoreCommentsFlag) {
+            ch = get();
+            if (ch == '/') {
+                while (true) {
+                    ch = get();
+                    if (ch == '\n' || ch == '\r' || ch == EOF) break;
+                }
+                continue;
+            } else if (ch == '*') {
+                int prev = EOF;
+                while (true) {
+                    ch = get();
+                    if (ch == EOF || (prev == '*' && ch == '/')) break;
+                    prev = ch;
+                }
+                continue;
+            }
+            if (ch != EOF) unget();
+            ch = '/';
+        }
+        if (ch == EOF) return {std::string_view(), TokenType(EOF)};
+        if ((ch == '"' || ch == '\'') && scanStringsFlag) {
+            unget();
+            scanString();
+        } else if (isdigit(ch) && scanNumbersFlag) {
+            unget();
+            std::string number = scanNumber();
+            if (number.size() != pos - start) {
+                current = number;
+                return {current, NUMBER};
+            }
+        } else if (isWordCharacter(ch)) {
+            while (pos < view.size() && isWordCharacter(view[pos])) pos++;
+        } else {
+            std::size_t length = 1;
+            while (isOperatorPrefix(view.substr(start, length))) {
+                if (pos >= view.size()) {
+                    eofSeen = true;
+                    break;
+                }
+                pos++;
+                length++;
+            }
+            while (length > 1 && !isOperator(view.substr(start, length))) {
+                unget();
+                length--;
+            }
+            std::string_view token = view.substr(start, length);
+            return {token, typeOf(token)};
+        }
+        std::string_view token = view.substr(start, pos - start);
+        return {token, typeOf(token)};
+    }
+}
+
 void TokenScanner::initScanner() {
+    AllocScope scope(ALLOC_SCANNER);
     ignoreWhitespaceFlag = false;
     ignoreCommentsFlag = false;
     scanNumbersFlag = false;
@@ -290,10 +483,10 @@ void TokenScanner::initScanner() {
 
 void TokenScanner::skipSpaces() {
     while (true) {
-        int ch = isp->get();
+        int ch = get();
         if (ch == EOF) return;
         if (!isspace(ch)) {
-            isp->unget();
+            unget();
             return;
         }
     }
@@ -309,10 +502,10 @@ void TokenScanner::skipSpaces() {
 std::string TokenScanner::scanWord() {
     std::string token = "";
     while (true) {
-        int ch = isp->get();
+        int ch = get();
         if (ch == EOF) break;
         if (!isWordCharacter(ch)) {
-            isp->unget();
+            unget();
             break;
         }
         token += char(ch);
@@ -334,8 +527,7 @@ std::string TokenScanner::scanNumber() {
     std::string token = "";
     NumberScannerState state = INITIAL_STATE;
     while (state != FINAL_STATE) {
-        int ch = isp->get();
-        int xch = 'e';
+        int ch = get();
         switch (state) {
             case INITIAL_STATE:
                 if (!isdigit(ch)) {
@@ -348,18 +540,16 @@ std::string TokenScanner::scanNumber() {
                     state = AFTER_DECIMAL_POINT;
                 } else if (ch == 'E' || ch == 'e') {
                     state = STARTING_EXPONENT;
-                    xch = ch;
                 } else if (!isdigit(ch)) {
-                    if (ch != EOF) isp->unget();
+                    if (ch != EOF) unget();
                     state = FINAL_STATE;
                 }
                 break;
             case AFTER_DECIMAL_POINT:
                 if (ch == 'E' || ch == 'e') {
                     state = STARTING_EXPONENT;
-                    xch = ch;
                 } else if (!isdigit(ch)) {
-                    if (ch != EOF) isp->unget();
+                    if (ch != EOF) unget();
                     state = FINAL_STATE;
                 }
                 break;
@@ -369,8 +559,8 @@ std::string TokenScanner::scanNumber() {
                 } else if (isdigit(ch)) {
                     state = SCANNING_EXPONENT;
                 } else {
-                    if (ch != EOF) isp->unget();
-                    isp->unget();
+                    if (ch != EOF) unget();
+                    unget();
                     state = FINAL_STATE;
                 }
                 break;
@@ -378,15 +568,15 @@ std::string TokenScanner::scanNumber() {
                 if (isdigit(ch)) {
                     state = SCANNING_EXPONENT;
                 } else {
-                    if (ch != EOF) isp->unget();
-                    isp->unget();
-                    isp->unget();
+                    if (ch != EOF) unget();
+                    unget();
+                    unget();
                     state = FINAL_STATE;
                 }
                 break;
             case SCANNING_EXPONENT:
                 if (!isdigit(ch)) {
-                    if (ch != EOF) isp->unget();
+                    if (ch != EOF) unget();
                     state = FINAL_STATE;
                 }
                 break;
@@ -411,11 +601,11 @@ std::string TokenScanner::scanNumber() {
 
 std::string TokenScanner::scanString() {
     std::string token = "";
-    char delim = isp->get();
+    char delim = get();
     token += delim;
     bool escape = false;
     while (true) {
-        int ch = isp->get();
+        int ch = get();
         if (ch == EOF) error("TokenScanner found unterminated string");
         if (ch == delim && !escape) break;
         escape = (ch == '\\') && !escape;
@@ -433,16 +623,16 @@ std::string TokenScanner::scanString() {
  * efficient by implementing operators as a trie.
  */
 
-bool TokenScanner::isOperator(std::string op) {
+bool TokenScanner::isOperator(std::string_view op) {
     for (StringCell *cp = operators; cp != nullptr; cp = cp->link) {
         if (op == cp->str) return true;
     }
     return false;
 }
 
-bool TokenScanner::isOperatorPrefix(std::string op) {
+bool TokenScanner::isOperatorPrefix(std::string_view op) {
     for (StringCell *cp = operators; cp != nullptr; cp = cp->link) {
-        if (startsWith(cp->str, op)) return true;
+        if (cp->str.compare(0, op.size(), op) == 0) return true;
     }
     return false;
 }
@@ -16,6 +16,7 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <sstream>
 
 /*
@@ -79,19 +80,45 @@ public:
 
     virtual ~TokenScanner();
 
+/*
+ * Type: Token
+ * -----------
+ * A token returned by <code>nextTokenView</code>: the text of the token
+ * together with its type.  At the end of the input the text is empty
+ * and the type is <code>TokenType(EOF)</code>, matching
+ * <code>getTokenType("")</code>.
+ */
+
+    struct Token {
+        std::string_view text;
+        TokenType type;
+    };
+
 /*
  * Method: setInput
  * Usage: scanner.setInput(str);
  *        scanner.setInput(infile);
  * --------------------------------
  * Sets the token stream for this scanner to the specified string or
- * input stream.  Any previous token stream is discarded.
+ * input stream.  Any previous token stream is discarded.  A string is
+ * copied once and then scanned in place.
  */
 
     void setInput(std::string str);
 
     void setInput(std::istream &infile);
 
+/*
+ * Method: setInputView
+ * Usage: scanner.setInputView(line);
+ * ----------------------------------
+ * Sets the token stream to the characters of <code>line</code> without
+ * copying them.  The characters must remain valid and unchanged for as
+ * long as the scanner, or any token view it returned, is in use.
+ */
+
+    void setInputView(std::string_view line);
+
 /*
  * Method: hasMoreTokens
  * Usage: if (scanner.hasMoreTokens()) ...
@@ -112,6 +139,19 @@ public:
 
     std::string nextToken();
 
+/*
+ * Method: nextTokenView
+ * Usage: Token token = scanner.nextTokenView();
+ * ---------------------------------------------
+ * Returns the next token without copying it.  When the scanner reads
+ * from a string the text is a view into that string; otherwise (an
+ * input stream, or a token pushed back with the string form of
+ * <code>saveToken</code>) it is a view of a scanner-owned copy that
+ * remains valid until the next call.
+ */
+
+    Token nextTokenView();
+
 /*
  * Method: saveToken
  * Usage: scanner.saveToken(token);
@@ -119,11 +159,33 @@ public:
  * Pushes the specified token back into this scanner's input stream.
  * On the next call to <code>nextToken</code>, the scanner will return
  * the saved token without reading any additional characters from the
- * token stream.
+ * token stream.  Saved tokens are kept in a small fixed buffer inside
+ * the scanner, so at most <code>SAVED_TOKEN_CAPACITY</code> tokens can
+ * be pushed back at once; saving a view of the input never copies it.
  */
 
     void saveToken(std::string token);
 
+    void saveToken(const Token &token);
+
+/*
+ * Method: peekToken
+ * Usage: Token token = scanner.peekToken();
+ * -----------------------------------------
+ * Returns the token that the next call to <code>nextTokenView</code>
+ * will return, without consuming it.
+ */
+
+    Token peekToken();
+
+/*
+ * Constant: SAVED_TOKEN_CAPACITY
+ * ------------------------------
+ * The number of tokens that can be pushed back at the same time.
+ */
+
+    static const int SAVED_TOKEN_CAPACITY = 4;
+
 /*
  * Method: getPosition
  * Usage: int pos = scanner.getPosition();
@@ -310,10 +372,10 @@ private:
  * Private type: StringCell
  * ------------------------
  * This type is used to construct linked lists of cells, which are used
- * to represent both the stack of saved tokens and the set of defined
- * operators.  These types cannot use the Stack and Lexicon classes
- * directly because tokenscanner.h is an extremely low-level interface,
- * and doing so would create circular dependencies in the .h files.
+ * to represent the set of defined operators.  These types cannot use
+ * the Stack and Lexicon classes directly because tokenscanner.h is an
+ * extremely low-level interface, and doing so would create circular
+ * dependencies in the .h files.
  */
 
     struct StringCell {
@@ -321,6 +383,20 @@ private:
         StringCell *link;
     };
 
+/*
+ * Private type: SavedToken
+ * ------------------------
+ * One entry of the ring buffer of saved tokens.  A token that is a
+ * view of the input is stored as that view; any other token is copied
+ * into storage, whose capacity is reused from one save to the next.
+ */
+
+    struct SavedToken {
+        std::string_view text;
+        TokenType type;
+        std::string storage;
+    };
+
     enum NumberScannerState {
         INITIAL_STATE,
         BEFORE_DECIMAL_POINT,
@@ -333,12 +409,19 @@ private:
 
     std::string buffer;              /* The original argument string */
     std::istream *isp = nullptr;     /* The input stream for tokens  */
+    bool viewMode = false;           /* Scanning view, not isp       */
+    std::string_view view;           /* The characters being scanned */
+    std::size_t pos = 0;             /* Next character in view       */
+    bool eofSeen = false;            /* get has returned EOF         */
+    std::string current;             /* Storage for copied tokens    */
     bool ignoreWhitespaceFlag;       /* Scanner ignores whitespace   */
     bool ignoreCommentsFlag;         /* Scanner ignores comments     */
     bool scanNumbersFlag;            /* Scanner parses numbers       */
     bool scanStringsFlag;            /* Scanner parses strings       */
     std::string wordChars;           /* Additional word characters   */
-    StringCell *savedTokens = nullptr;         /* Stack of saved tokens        */
+    SavedToken saved[SAVED_TOKEN_CAPACITY];   /* Ring of saved tokens      */
+    int savedHead = 0;               /* Most recently saved token    */
+    int savedCount = 0;              /* Number of saved tokens       */
     StringCell *operators = nullptr;           /* List of multichar operators  */
 
 /* Private method prototypes */
@@ -347,15 +430,29 @@ private:
 
     void skipSpaces();
 
+    int get();
+
+    void unget();
+
     std::string scanWord();
 
     std::string scanNumber();
 
     std::string scanString();
 
-    bool isOperator(std::string op);
+    bool isOperator(std::string_view op);
+
+    bool isOperatorPrefix(std::string_view op);
+
+    Token scanTokenView();
+
+    TokenType typeOf(std::string_view token) const;
+
+    void clearSavedTokens();
+
+    void pushSaved(std::string_view text, TokenType type, bool copy);
 
-    bool isOperatorPrefix(std::string op);
+    Token popSaved();
 
 };
 
@@ -0,0 +1,93 @@
+/*
+ * File: allocstats.cpp
+ * --------------------
+ * This file implements the allocstats.h interface.  With
+ * BASIC_COUNT_ALLOCATIONS defined it also replaces the global operator
+ * new and operator delete.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "allocstats.hpp"
+
+thread_local AllocSubsystem currentAllocSubsystem = ALLOC_OTHER;
+
+/*
+ * Implementation notes: counters
+ * ------------------------------
+ * The loader parses on several threads, so the counters are atomic.
+ * Relaxed increments are enough, since the counts are only read once
+ * the work being measured has finished.
+ */
+
+static std::atomic<long long> allocations[ALLOC_SUBSYSTEMS];
+static std::atomic<long long> bytes[ALLOC_SUBSYSTEMS];
+
+static const char *const SUBSYSTEM_NAMES[ALLOC_SUBSYSTEMS] = {
+    "other", "scanner", "parser", "program", "eval", "output"
+};
+
+#ifdef BASIC_COUNT_ALLOCATIONS
+
+/*
+ * Implementation notes: operator new, operator delete
+ * ---------------------------------------------------
+ * The array, sized and nothrow forms call these by default, so
+ * replacing the plain forms counts every allocation except over-aligned
+ * ones, which the interpreter does not make.
+ */
+
+void *operator new(std::size_t size) {
+    AllocSubsystem subsystem = currentAllocSubsystem;
+    allocations[subsystem].fetch_add(1, std::memory_order_relaxed);
+    bytes[subsystem].fetch_add((long long) size, std::memory_order_relaxed);
+    void *memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+#endif
+
+AllocCounts allocationCounts(AllocSubsystem subsystem) {
+    AllocCounts counts = {0, 0};
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        if (subsystem != ALLOC_SUBSYSTEMS && subsystem != i) continue;
+        counts.allocations += allocations[i].load(std::memory_order_relaxed);
+        counts.bytes += bytes[i].load(std::memory_order_relaxed);
+    }
+    return counts;
+}
+
+void resetAllocationCounts() {
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        allocations[i].store(0, std::memory_order_relaxed);
+        bytes[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+std::string allocationReport() {
+    AllocCounts counts[ALLOC_SUBSYSTEMS + 1];
+    for (int i = 0; i <= ALLOC_SUBSYSTEMS; i++) {
+        counts[i] = allocationCounts(AllocSubsystem(i));
+    }
+    char line[80];
+    std::snprintf(line, sizeof line, "%-10s %12s %14s\n", "SUBSYSTEM", "ALLOCATIONS", "BYTES");
+    std::string report = line;
+    for (int i = 0; i <= ALLOC_SUBSYSTEMS; i++) {
+        const char *name = i < ALLOC_SUBSYSTEMS ? SUBSYSTEM_NAMES[i] : "total";
+        std::snprintf(line, sizeof line, "%-10s %12lld %14lld\n",
+                      name, counts[i].allocations, counts[i].bytes);
+        report += line;
+    }
+    return report;
+}
@@ -0,0 +1,140 @@
+/*
+ * File: allocstats.h
+ * ------------------
+ * This interface exports the allocation counters that the interpreter
+ * keeps when it is built with BASIC_COUNT_ALLOCATIONS defined.  In a
+ * normal build the counters stay at zero and cost nothing.
+ */
+
+#ifndef _allocstats_h
+#define _allocstats_h
+
+#include <string>
+
+/*
+ * Type: AllocSubsystem
+ * --------------------
+ * The parts of the interpreter that heap allocations are charged to.
+ * ALLOC_OTHER covers everything outside a scope, and ALLOC_SUBSYSTEMS
+ * is the number of subsystems.
+ */
+
+enum AllocSubsystem {
+    ALLOC_OTHER,
+    ALLOC_SCANNER,
+    ALLOC_PARSER,
+    ALLOC_PROGRAM,
+    ALLOC_EVAL,
+    ALLOC_OUTPUT,
+    ALLOC_SUBSYSTEMS
+};
+
+/*
+ * Constant: countingAllocations
+ * -----------------------------
+ * True if this build counts allocations.
+ */
+
+#ifdef BASIC_COUNT_ALLOCATIONS
+const bool countingAllocations = true;
+#else
+const bool countingAllocations = false;
+#endif
+
+/*
+ * Variable: currentAllocSubsystem
+ * -------------------------------
+ * The subsystem that allocations on this thread are charged to.  It is
+ * set by AllocScope and read by the replacement operator new.
+ */
+
+extern thread_local AllocSubsystem currentAllocSubsystem;
+
+/*
+ * Class: AllocScope
+ * -----------------
+ * Charges the allocations made during its lifetime on this thread to a
+ * subsystem, and restores the previous subsystem when it is destroyed.
+ * Scopes nest, so the innermost one wins: the output written by a
+ * running program is charged to ALLOC_OUTPUT, not ALLOC_EVAL.
+ */
+
+#ifdef BASIC_COUNT_ALLOCATIONS
+
+class AllocScope {
+
+public:
+
+    explicit AllocScope(AllocSubsystem subsystem) : saved(currentAllocSubsystem) {
+        currentAllocSubsystem = subsystem;
+    }
+
+    ~AllocScope() {
+        currentAllocSubsystem = saved;
+    }
+
+    AllocScope(const AllocScope &) = delete;
+    AllocScope &operator=(const AllocScope &) = delete;
+
+private:
+
+    AllocSubsystem saved;
+
+};
+
+#else
+
+class AllocScope {
+
+public:
+
+    explicit AllocScope(AllocSubsystem) {
+    }
+
+};
+
+#endif
+
+/*
+ * Type: AllocCounts
+ * -----------------
+ * The number of allocations charged to a subsystem and the number of
+ * bytes they requested.
+ */
+
+struct AllocCounts {
+    long long allocations;
+    long long bytes;
+};
+
+/*
+ * Function: allocationCounts
+ * Usage: AllocCounts counts = allocationCounts(ALLOC_EVAL);
+ * ---------------------------------------------------------
+ * Returns the counts for subsystem since the last reset, or the totals
+ * over all subsystems if subsystem is ALLOC_SUBSYSTEMS.
+ */
+
+AllocCounts allocationCounts(AllocSubsystem subsystem);
+
+/*
+ * Function: resetAllocationCounts
+ * Usage: resetAllocationCounts();
+ * -------------------------------
+ * Sets every counter back to zero.
+ */
+
+void resetAllocationCounts();
+
+/*
+ * Function: allocationReport
+ * Usage: std::string text = allocationReport();
+ * ---------------------------------------------
+ * Returns a table of the counts, one line per subsystem followed by the
+ * total.  The counts are read before the table is built, so they do
+ * not include the allocations made by the report itself.
+ */
+
+std::string allocationReport();
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * File: arena.cpp
+ * ---------------
+ * This file implements the Arena class.
+ */
+
+#include <cstdint>
+#include "arena.hpp"
+
+Arena::Arena() {
+    ptr = first;
+    end = first + INLINE_SIZE;
+    blocks = nullptr;
+    cleanups = nullptr;
+    used = 0;
+}
+
+Arena::~Arena() {
+    runCleanups();
+    freeBlocks();
+}
+
+void Arena::reset() {
+    runCleanups();
+    freeBlocks();
+    ptr = first;
+    end = first + INLINE_SIZE;
+    used = 0;
+}
+
+std::size_t Arena::bytesUsed() const {
+    return used;
+}
+
+std::size_t Arena::bytesFree() const {
+    return std::size_t(end - ptr);
+}
+
+/*
+ * Implementation notes: allocate
+ * ------------------------------
+ * The fast path rounds the free pointer up to the requested alignment
+ * and bumps it.  Only when the current block is exhausted does the
+ * arena go to the heap.
+ */
+
+void *Arena::allocate(std::size_t size, std::size_t align) {
+    std::uintptr_t p = (std::uintptr_t(ptr) + align - 1) & ~std::uintptr_t(align - 1);
+    if (p + size > std::uintptr_t(end)) return allocateSlow(size, align);
+    used += p + size - std::uintptr_t(ptr);
+    ptr = (char *) (p + size);
+    return (void *) p;
+}
+
+/*
+ * Implementation notes: allocateSlow
+ * ----------------------------------
+ * Each new block is twice the size of the previous one, up to
+ * MAX_BLOCK_SIZE, and always large enough for the request, so a line
+ * with a very long expression needs only a logarithmic number of heap
+ * allocations, while an arena shared by many lines wastes at most one
+ * partly used block.  The space left in the old block is abandoned.
+ */
+
+void *Arena::allocateSlow(std::size_t size, std::size_t align) {
+    std::size_t blockSize = (blocks == nullptr) ? 2 * INLINE_SIZE : 2 * blocks->size;
+    if (blockSize > MAX_BLOCK_SIZE) blockSize = MAX_BLOCK_SIZE;
+    std::size_t header = (sizeof(Block) + alignof(std::max_align_t) - 1)
+                         & ~(alignof(std::max_align_t) - 1);
+    while (blockSize < header + size + align) blockSize *= 2;
+    Block *block = (Block *) ::operator new(blockSize);
+    block->next = blocks;
+    block->size = blockSize;
+    blocks = block;
+    ptr = (char *) block + header;
+    end = (char *) block + blockSize;
+    return allocate(size, align);
+}
+
+void Arena::runCleanups() {
+    while (cleanups != nullptr) {
+        Cleanup *cleanup = cleanups;
+        cleanups = cleanup->next;
+        cleanup->destroy(cleanup->obj);
+    }
+}
+
+void Arena::freeBlocks() {
+    while (blocks != nullptr) {
+        Block *block = blocks;
+        blocks = block->next;
+        ::operator delete(block);
+    }
+}
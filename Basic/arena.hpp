@@ -0,0 +1,169 @@
+/*
+ * File: arena.h
+ * -------------
+ * This interface exports the Arena class, a bump allocator that owns
+ * the objects created for program lines: their statements and all the
+ * nodes of their expression trees.
+ */
+
+#ifndef _arena_h
+#define _arena_h
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Class: Arena
+ * ------------
+ * Objects are carved out of large blocks in the order they are made,
+ * so the nodes of one line sit next to each other in memory, and they
+ * are all destroyed together, in reverse order of creation, when the
+ * arena is destroyed or reset.  Objects allocated in an arena must not
+ * be deleted individually, and pointers between objects in the same
+ * arena never need to be freed.
+ */
+
+class Arena {
+
+public:
+
+/*
+ * Constructor: Arena
+ * Usage: Arena arena;
+ * -------------------
+ * Creates an empty arena.  The first block is part of the arena
+ * itself, so a typical line is parsed without any heap allocation
+ * beyond the one for the arena.
+ */
+
+    Arena();
+
+/*
+ * Destructor: ~Arena
+ * ------------------
+ * Destroys every object made in the arena and frees its blocks.
+ */
+
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+/*
+ * Method: make
+ * Usage: T *obj = arena.make<T>(args);
+ * ------------------------------------
+ * Constructs a T from args in storage owned by the arena.  If T has a
+ * nontrivial destructor, it runs when the arena is reset or destroyed.
+ */
+
+    template <typename T, typename... Args>
+    T *make(Args &&... args) {
+        Cleanup *cleanup = nullptr;
+        if (!std::is_trivially_destructible<T>::value) {
+            cleanup = (Cleanup *) allocate(sizeof(Cleanup), alignof(Cleanup));
+        }
+        T *obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (cleanup != nullptr) {
+            cleanup->destroy = [](void *p) { ((T *) p)->~T(); };
+            cleanup->obj = obj;
+            cleanup->next = cleanups;
+            cleanups = cleanup;
+        }
+        return obj;
+    }
+
+/*
+ * Method: allocate
+ * Usage: void *p = arena.allocate(size, align);
+ * ---------------------------------------------
+ * Returns size bytes of uninitialized storage aligned to align, which
+ * must be a power of two no larger than alignof(std::max_align_t).
+ */
+
+    void *allocate(std::size_t size, std::size_t align);
+
+/*
+ * Method: reset
+ * Usage: arena.reset();
+ * ---------------------
+ * Destroys every object in the arena and releases all blocks except
+ * the first, leaving the arena ready for reuse.
+ */
+
+    void reset();
+
+/*
+ * Method: bytesUsed
+ * Usage: std::size_t n = arena.bytesUsed();
+ * -----------------------------------------
+ * Returns the number of bytes handed out since the last reset,
+ * including alignment padding.
+ */
+
+    std::size_t bytesUsed() const;
+
+/*
+ * Method: bytesFree
+ * Usage: std::size_t n = arena.bytesFree();
+ * -----------------------------------------
+ * Returns the number of bytes left in the current block, which the
+ * arena hands out before it goes to the heap again.
+ */
+
+    std::size_t bytesFree() const;
+
+/*
+ * Constant: INLINE_SIZE
+ * ---------------------
+ * The size of the block that is embedded in the arena.
+ */
+
+    static const std::size_t INLINE_SIZE = 512;
+
+/*
+ * Constant: MAX_BLOCK_SIZE
+ * ------------------------
+ * The size beyond which blocks stop growing, unless a single request
+ * needs more.
+ */
+
+    static const std::size_t MAX_BLOCK_SIZE = 65536;
+
+private:
+
+/*
+ * Private types: Cleanup, Block
+ * -----------------------------
+ * A Cleanup records an object whose destructor must run; the records
+ * are allocated in the arena and form a stack.  A Block header starts
+ * every block that was allocated from the heap.
+ */
+
+    struct Cleanup {
+        void (*destroy)(void *);
+        void *obj;
+        Cleanup *next;
+    };
+
+    struct Block {
+        Block *next;
+        std::size_t size;
+    };
+
+    void *allocateSlow(std::size_t size, std::size_t align);
+    void runCleanups();
+    void freeBlocks();
+
+    alignas(std::max_align_t) char first[INLINE_SIZE];   /* Inline block     */
+    char *ptr;                     /* Next free byte in current block  */
+    char *end;                     /* End of current block             */
+    Block *blocks;                 /* Heap blocks, most recent first   */
+    Cleanup *cleanups;             /* Destructors to run, newest first */
+    std::size_t used;              /* Bytes handed out                 */
+
+};
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * File: bytecode.cpp
+ * ------------------
+ * This file implements the bytecode compiler and the stack machine
+ * declared in bytecode.h.
+ */
+
+#include "bytecode.hpp"
+#include "program.hpp"
+#include "statement.hpp"
+
+bool useBytecode = true;
+
+/* Implementation of the Chunk class */
+
+Chunk::Chunk() {
+    maxStack = 0;
+    depth = 0;
+}
+
+/*
+ * Implementation notes: emit
+ * --------------------------
+ * Every opcode has a fixed effect on the stack depth, so the maximum
+ * depth can be computed while the code is generated and the machine
+ * never has to check for stack overflow.
+ */
+
+void Chunk::emit(OpCode op, int operand) {
+    code.push_back({op, operand});
+    switch (op) {
+        case OP_CONST: case OP_CONST_WIDE:
+        case OP_LOAD:
+            depth++;
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_LET: case OP_SYNTAX_ERROR: case OP_PRINT:
+            depth--;
+            break;
+        case OP_IF_LT: case OP_IF_GT: case OP_IF_EQ:
+            depth -= 2;
+            break;
+        case OP_FAIL:
+            depth++;
+            break;
+        default:
+            break;
+    }
+    if (depth > maxStack) maxStack = depth;
+}
+
+int Chunk::addMessage(const std::string &msg) {
+    messages.push_back(msg);
+    return int(messages.size()) - 1;
+}
+
+int Chunk::addConstant(Value value) {
+    constants.push_back(value);
+    return int(constants.size()) - 1;
+}
+
+int Chunk::addTarget(int lineNumber) {
+    targets.push_back({lineNumber, -1});
+    return int(targets.size()) - 1;
+}
+
+void Chunk::link(const Program &program) {
+    for (JumpTarget &target : targets) {
+        target.index = program.indexOf(target.line);
+    }
+}
+
+bool Chunk::empty() const {
+    return code.empty();
+}
+
+/*
+ * Implementation notes: compileExp
+ * --------------------------------
+ * The compiler performs a postorder walk of the tree.  The checks that
+ * CompoundExp::eval makes on the target of an assignment happen before
+ * the right-hand side is evaluated, so they are emitted first.
+ */
+
+void compileExp(Expression *exp, Chunk &chunk) {
+    switch (exp->getType()) {
+        case CONSTANT: {
+            Value value = ((ConstantExp *) exp)->getValue();
+            if (fitsInt(value)) {
+                chunk.emit(OP_CONST, int(value));
+            } else {
+                chunk.emit(OP_CONST_WIDE, chunk.addConstant(value));
+            }
+            return;
+        }
+        case IDENTIFIER:
+            chunk.emit(OP_LOAD, ((IdentifierExp *) exp)->getSlot());
+            return;
+        case COMPOUND:
+            break;
+    }
+    CompoundExp *cexp = (CompoundExp *) exp;
+    Operator op = cexp->getOperator();
+    Expression *lhs = cexp->getLHS();
+    Expression *rhs = cexp->getRHS();
+    if (op == ASSIGN_OP) {
+        if (lhs->getType() != IDENTIFIER) {
+            chunk.emit(OP_FAIL, chunk.addMessage("Illegal variable in assignment"));
+            return;
+        }
+        if (lhs->toString() == "LET") {
+            chunk.emit(OP_FAIL, chunk.addMessage("SYNTAX ERROR"));
+            return;
+        }
+        compileExp(rhs, chunk);
+        chunk.emit(OP_ASSIGN, ((IdentifierExp *) lhs)->getSlot());
+        return;
+    }
+    if (op == SHL_OP) {
+        compileExp(lhs, chunk);
+        chunk.emit(OP_SHL, ((ShlExp *) cexp)->getShift());
+        return;
+    }
+    compileExp(lhs, chunk);
+    compileExp(rhs, chunk);
+    switch (op) {
+        case ADD_OP: chunk.emit(OP_ADD); break;
+        case SUB_OP: chunk.emit(OP_SUB); break;
+        case MUL_OP: chunk.emit(OP_MUL); break;
+        case DIV_OP: chunk.emit(OP_DIV); break;
+        default: break;
+    }
+}
+
+/*
+ * Implementation notes: runChunk
+ * ------------------------------
+ * The evaluation stack lives in a fixed-size local array, which is
+ * large enough for all but pathologically nested expressions; those
+ * fall back to a heap-allocated stack.  Jump targets were resolved
+ * when the chunk was linked; a target that does not exist is reported
+ * only when the branch is actually taken.  The opcodes that only
+ * ThreadedCode emits are listed rather than left to a default, so that
+ * the compiler still warns when a new opcode is not handled here.
+ */
+
+static const int INLINE_STACK_SIZE = 64;
+
+static void jumpTo(const JumpTarget &target, Program &program) {
+    if (target.index < 0) {
+        error("LINE NUMBER ERROR");
+    }
+    program.jump_index = target.index;
+}
+
+void runChunk(const Chunk &chunk, EvalState &state, Program &program) {
+    Value inlineStack[INLINE_STACK_SIZE];
+    std::vector<Value> heapStack;
+    Value *stack = inlineStack;
+    if (chunk.maxStack > INLINE_STACK_SIZE) {
+        heapStack.resize(chunk.maxStack);
+        stack = heapStack.data();
+    }
+    int sp = 0;
+    const Instruction *ip = chunk.code.data();
+    while (true) {
+        const Instruction &in = *ip++;
+        switch (in.op) {
+            case OP_CONST:
+                stack[sp++] = in.operand;
+                break;
+            case OP_CONST_WIDE:
+                stack[sp++] = chunk.constants[in.operand];
+                break;
+            case OP_LOAD:
+                if (!state.isDefined(in.operand)) error("VARIABLE NOT DEFINED");
+                stack[sp++] = state.getValue(in.operand);
+                break;
+            case OP_ASSIGN:
+                state.setValue(in.operand, stack[sp - 1]);
+                break;
+            case OP_ADD:
+                sp--;
+                stack[sp - 1] = addValues(stack[sp - 1], stack[sp]);
+                break;
+            case OP_SUB:
+                sp--;
+                stack[sp - 1] = subValues(stack[sp - 1], stack[sp]);
+                break;
+            case OP_MUL:
+                sp--;
+                stack[sp - 1] = mulValues(stack[sp - 1], stack[sp]);
+                break;
+            case OP_DIV:
+                sp--;
+                stack[sp - 1] = divValues(stack[sp - 1], stack[sp]);
+                break;
+            case OP_SHL:
+                stack[sp - 1] = shlValue(stack[sp - 1], in.operand);
+                break;
+            case OP_FAIL:
+                error(chunk.messages[in.operand]);
+                break;
+            case OP_LET:
+                state.setValue(in.operand, stack[--sp]);
+                break;
+            case OP_SYNTAX_ERROR:
+                sp--;
+                state.output() << "SYNTAX ERROR\n";
+                break;
+            case OP_PRINT:
+                state.output() << stack[--sp] << '\n';
+                break;
+            case OP_INPUT: {
+                Value value = readInputNumber(state);
+                if (state.waitingForInput()) {
+                    program.whether_stop = true;
+                    return;
+                }
+                state.setValue(in.operand, value);
+                break;
+            }
+            case OP_GOTO:
+                jumpTo(chunk.targets[in.operand], program);
+                break;
+            case OP_IF_LT:
+                sp -= 2;
+                if (stack[sp] < stack[sp + 1]) jumpTo(chunk.targets[in.operand], program);
+                break;
+            case OP_IF_GT:
+                sp -= 2;
+                if (stack[sp] > stack[sp + 1]) jumpTo(chunk.targets[in.operand], program);
+                break;
+            case OP_IF_EQ:
+                sp -= 2;
+                if (stack[sp] == stack[sp + 1]) jumpTo(chunk.targets[in.operand], program);
+                break;
+            case OP_END:
+                program.whether_stop = true;
+                break;
+            case OP_RETURN:
+                return;
+            case OP_CALL:
+            case OP_ADD_CONST:
+            case OP_IF_CONST_LT:
+            case OP_IF_CONST_GT:
+            case OP_IF_CONST_EQ:
+                error("Internal error: unexpected opcode");
+                return;
+        }
+    }
+}
@@ -0,0 +1,193 @@
+/*
+ * File: bytecode.h
+ * ----------------
+ * This interface exports a compact linear representation of BASIC
+ * statements together with the compiler that lowers Expression trees
+ * into it and the stack machine that executes it.  The Expression
+ * tree is kept alongside the bytecode for toString and for the tree
+ * interpreter used in differential testing.
+ */
+
+#ifndef _bytecode_h
+#define _bytecode_h
+
+#include <string>
+#include <vector>
+#include "evalstate.hpp"
+#include "exp.hpp"
+
+class Program;
+
+/*
+ * Type: OpCode
+ * ------------
+ * The instructions understood by the virtual machine.  The first group
+ * operates on the evaluation stack only; the second group implements
+ * the effect of a whole statement and consumes the values that the
+ * expression code left on the stack.  The last group appears only in
+ * the whole-program code built by ThreadedCode (see threaded.h).
+ */
+
+enum OpCode : unsigned char {
+    OP_CONST,          /* push operand                                */
+    OP_CONST_WIDE,     /* push constants[operand]                     */
+    OP_LOAD,           /* push value of variable in slot operand      */
+    OP_ASSIGN,         /* slot operand = top, leaving top in place    */
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+    OP_SHL,            /* shift top left by operand bits              */
+    OP_FAIL,           /* raise error(messages[operand])              */
+    OP_LET,            /* pop into variable in slot operand           */
+    OP_SYNTAX_ERROR,   /* pop and report SYNTAX ERROR                 */
+    OP_PRINT,          /* pop and print                               */
+    OP_INPUT,          /* read a number into variable in slot operand */
+    OP_GOTO,           /* jump to targets[operand]                    */
+    OP_IF_LT, OP_IF_GT, OP_IF_EQ,  /* pop rhs, lhs; jump if true      */
+    OP_END,            /* stop the running program                    */
+    OP_RETURN,         /* end of chunk                                */
+    OP_CALL,           /* execute a statement that has no bytecode    */
+    OP_ADD_CONST,      /* fused LET v = w + c                         */
+    OP_IF_CONST_LT, OP_IF_CONST_GT, OP_IF_CONST_EQ  /* fused IF v op c  */
+};
+
+/*
+ * Type: Instruction
+ * -----------------
+ * A single bytecode instruction.  The meaning of operand depends on
+ * the opcode; instructions without an operand leave it at zero.
+ */
+
+struct Instruction {
+    OpCode op;
+    int operand;
+};
+
+/*
+ * Type: JumpTarget
+ * ----------------
+ * A branch target.  The line number is fixed when the statement is
+ * parsed; index is the position of that line in the program's line
+ * table, or -1 if the line does not exist, and is filled in by link.
+ */
+
+struct JumpTarget {
+    int line;
+    int index;
+};
+
+/*
+ * Class: Chunk
+ * ------------
+ * The bytecode for one program line.  Variables are referred to by the
+ * slot they were interned as, and error messages and constants that do
+ * not fit in an int are stored in side tables, so that every
+ * instruction has the same fixed size.
+ */
+
+class Chunk {
+
+public:
+
+    Chunk();
+
+/*
+ * Method: emit
+ * Usage: chunk.emit(op, operand);
+ * -------------------------------
+ * Appends an instruction to the chunk and updates the running stack
+ * depth bookkeeping used to size the evaluation stack.
+ */
+
+    void emit(OpCode op, int operand = 0);
+
+/*
+ * Method: addMessage
+ * Usage: int index = chunk.addMessage(msg);
+ * -----------------------------------------
+ * Adds an error message to the message table and returns its index.
+ */
+
+    int addMessage(const std::string &msg);
+
+/*
+ * Method: addConstant
+ * Usage: int index = chunk.addConstant(value);
+ * --------------------------------------------
+ * Adds a constant too wide for an operand and returns its index.
+ */
+
+    int addConstant(Value value);
+
+/*
+ * Method: addTarget
+ * Usage: int index = chunk.addTarget(lineNumber);
+ * -----------------------------------------------
+ * Adds an unresolved branch target and returns its index, which is
+ * used as the operand of the jump instruction.
+ */
+
+    int addTarget(int lineNumber);
+
+/*
+ * Method: link
+ * Usage: chunk.link(program);
+ * ---------------------------
+ * Resolves every branch target against the current line table.
+ */
+
+    void link(const Program &program);
+
+/*
+ * Method: empty
+ * Usage: if (chunk.empty()) . . .
+ * -------------------------------
+ * Returns true if nothing has been compiled into this chunk.
+ */
+
+    bool empty() const;
+
+    std::vector<Instruction> code;
+    std::vector<std::string> messages;
+    std::vector<Value> constants;
+    std::vector<JumpTarget> targets;
+    int maxStack;
+
+private:
+
+    int depth;
+
+};
+
+/*
+ * Function: compileExp
+ * Usage: compileExp(exp, chunk);
+ * ------------------------------
+ * Appends code to chunk that leaves the value of exp on top of the
+ * evaluation stack.  Errors that the tree interpreter raises while
+ * evaluating (for example an illegal assignment target) are compiled
+ * into OP_FAIL so that they are still reported at run time.
+ */
+
+void compileExp(Expression *exp, Chunk &chunk);
+
+/*
+ * Function: runChunk
+ * Usage: runChunk(chunk, state, program);
+ * ---------------------------------------
+ * Executes a statement chunk.  Control transfers are reported through
+ * program in the same way as the tree interpreter does.  The chunk
+ * must have been linked against program.
+ */
+
+void runChunk(const Chunk &chunk, EvalState &state, Program &program);
+
+/*
+ * Variable: useBytecode
+ * ---------------------
+ * Selects the virtual machine (true, the default) or the original tree
+ * interpreter (false).  Both must produce identical output; the tree
+ * interpreter is kept for differential testing.
+ */
+
+extern bool useBytecode;
+
+#endif
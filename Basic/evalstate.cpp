@@ -7,14 +7,55 @@
  */
 
 
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
 #include "evalstate.hpp"
 
 
 //using namespace std;
 
+/*
+ * Implementation notes: Symbols
+ * -----------------------------
+ * The name-to-slot map is only consulted when a line is parsed or when
+ * a variable is accessed by name; evaluation uses slots directly.
+ * Lines may be parsed on several threads at once, so every access
+ * holds the table's lock.  Names are kept in a deque so that the
+ * references returned by nameOf stay valid as new names are added.
+ */
+
+int Symbols::intern(const std::string &name) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = slots.find(name);
+    if (it != slots.end()) return it->second;
+    int slot = int(names.size());
+    names.push_back(name);
+    slots.emplace(name, slot);
+    return slot;
+}
+
+int Symbols::lookup(const std::string &name) const {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = slots.find(name);
+    return it == slots.end() ? -1 : it->second;
+}
+
+const std::string &Symbols::nameOf(int slot) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return names[slot];
+}
+
+int Symbols::count() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return int(names.size());
+}
+
 /* Implementation of the EvalState class */
 
-EvalState::EvalState() {
+EvalState::EvalState(int fd) : out(fd), in(&std::cin) {
     /* Empty */
 }
 
@@ -22,20 +63,47 @@ EvalState::~EvalState() {
     /* Empty */
 }
 
-void EvalState::setValue(std::string var, int value) {
-    if(isDefined(var)) symbolTable[var] = value;
-    else symbolTable.emplace(var,value);
+void EvalState::setValue(const std::string &var, Value value) {
+    setValue(table.intern(var), value);
 }
 
-int EvalState::getValue(std::string var) {
-    if(isDefined(var)) return symbolTable[var];
+Value EvalState::getValue(const std::string &var) {
+    int slot = table.lookup(var);
+    if(slot >= 0 && isDefined(slot)) return values[slot];
     else return 0;
 }
 
-bool EvalState::isDefined(std::string var) {
-    return symbolTable.find(var)!=symbolTable.end();
+bool EvalState::isDefined(const std::string &var) {
+    int slot = table.lookup(var);
+    return slot >= 0 && isDefined(slot);
+}
+
+bool EvalState::readLine(std::string &line) {
+    if (in != nullptr) {
+        std::getline(*in, line);
+        return true;
+    }
+    waiting = queued.empty();
+    if (waiting) return false;
+    line = std::move(queued.front());
+    queued.pop_front();
+    return true;
 }
 
 void EvalState::Clear() {
-    symbolTable.clear();
+    std::fill(defined.begin(), defined.end(), 0);
+}
+
+/*
+ * Implementation notes: grow
+ * --------------------------
+ * Sizes the value array for every slot interned in this state's table
+ * so far, so that a state normally grows only once after the program
+ * has been parsed.
+ */
+
+void EvalState::grow(int slot) {
+    int size = std::max(slot + 1, table.count());
+    values.resize(size, 0);
+    defined.resize((size + 63) / 64, 0);
 }
\ No newline at end of file
@@ -9,8 +9,75 @@
 #ifndef _evalstate_h
 #define _evalstate_h
 
+#include <deque>
+#include <istream>
+#include <mutex>
 #include <string>
-#include <map>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include "output.hpp"
+#include "value.hpp"
+
+/*
+ * Class: Symbols
+ * --------------
+ * This class interns variable names.  Every distinct name is assigned
+ * a small dense integer, its slot, the first time it is seen by the
+ * parser.  Each EvalState has a table of its own, and a line is parsed
+ * against the table of the state it will be executed in, so the slots
+ * of one session never depend on the names another session has used.
+ * The methods may be called from several threads at once, as they are
+ * when a program is loaded.
+ */
+
+class Symbols {
+
+public:
+
+/*
+ * Method: intern
+ * Usage: int slot = symbols.intern(name);
+ * ---------------------------------------
+ * Returns the slot for name, assigning a new one if necessary.
+ */
+
+    int intern(const std::string &name);
+
+/*
+ * Method: lookup
+ * Usage: int slot = symbols.lookup(name);
+ * ---------------------------------------
+ * Returns the slot for name, or -1 if name has never been interned.
+ */
+
+    int lookup(const std::string &name) const;
+
+/*
+ * Method: nameOf
+ * Usage: string name = symbols.nameOf(slot);
+ * ------------------------------------------
+ * Returns the name that was interned as slot.
+ */
+
+    const std::string &nameOf(int slot) const;
+
+/*
+ * Method: count
+ * Usage: int n = symbols.count();
+ * -------------------------------
+ * Returns the number of slots assigned so far.
+ */
+
+    int count() const;
+
+private:
+
+    mutable std::mutex lock;
+    std::unordered_map<std::string, int> slots;
+    std::deque<std::string> names;    /* By slot; references stay valid */
+
+};
 
 /*
  * Class: EvalState
@@ -19,9 +86,10 @@
  * of the evaluator and contains information from the evaluation
  * environment that the evaluator may need to know.  In this
  * version, the only information maintained by the EvalState class
- * is a symbol table that maps variable names into their values.
- * In your implementation, you may include additional information
- * in the EvalState class.
+ * is the value of every variable, stored in a flat array indexed by
+ * the slot the variable name was interned as in the state's own table
+ * (see Symbols), together with a bitmap recording which variables have
+ * been defined.
  */
 
 class EvalState {
@@ -31,11 +99,14 @@ public:
 /*
  * Constructor: EvalState
  * Usage: EvalState state;
- * -----------------------
- * Creates a new EvalState object with no variable bindings.
+ *        EvalState state(fd);
+ * ---------------------------
+ * Creates a new EvalState object with no variable bindings, whose
+ * output goes to fd (standard output by default) and whose INPUT reads
+ * standard input.
  */
 
-    EvalState();
+    explicit EvalState(int fd = 1);
 
 /*
  * Destructor: ~EvalState
@@ -49,35 +120,155 @@ public:
 /*
  * Method: setValue
  * Usage: state.setValue(var, value);
+ *        state.setValue(slot, value);
  * ----------------------------------
- * Sets the value associated with the specified var.
+ * Sets the value associated with the specified var.  The slot form is
+ * used by parsed code, whose variables were interned at parse time.
  */
 
-    void setValue(std::string var, int value);
+    void setValue(const std::string &var, Value value);
+
+    void setValue(int slot, Value value) {
+        if (slot >= int(values.size())) grow(slot);
+        values[slot] = value;
+        defined[slot >> 6] |= uint64_t(1) << (slot & 63);
+    }
 
 /*
  * Method: getValue
- * Usage: int value = state.getValue(var);
+ * Usage: Value value = state.getValue(var);
+ *        Value value = state.getValue(slot);
  * ---------------------------------------
- * Returns the value associated with the specified variable.
+ * Returns the value associated with the specified variable.  The slot
+ * form may only be applied to a variable for which isDefined is true.
  */
 
-    int getValue(std::string var);
+    Value getValue(const std::string &var);
+
+    Value getValue(int slot) const {
+        return values[slot];
+    }
 
 /*
  * Method: isDefined
  * Usage: if (state.isDefined(var)) . . .
+ *        if (state.isDefined(slot)) . . .
  * --------------------------------------
  * Returns true if the specified variable is defined.
  */
 
-    bool isDefined(std::string var);
+    bool isDefined(const std::string &var);
+
+    bool isDefined(int slot) const {
+        return slot < int(values.size())
+               && (defined[slot >> 6] >> (slot & 63) & 1) != 0;
+    }
 
     void Clear();
 
+/*
+ * Method: symbols
+ * Usage: int slot = state.symbols().intern(name);
+ * -----------------------------------------------
+ * Returns the table that maps the names of this state's variables to
+ * their slots.
+ */
+
+    Symbols &symbols() {
+        return table;
+    }
+
+/*
+ * Method: valueArray
+ * Usage: Value *values = state.valueArray();
+ * ----------------------------------------
+ * Returns the values of the variables, indexed by slot, for native
+ * code.  The pointer is valid until a value is stored in a slot that
+ * was never used before.
+ */
+
+    Value *valueArray() {
+        return values.data();
+    }
+
+/*
+ * Method: output
+ * Usage: state.output() << value << '\n';
+ * --------------------------------------
+ * Returns the sink that PRINT, LIST, prompts and error messages are
+ * written to.
+ */
+
+    Output &output() {
+        return out;
+    }
+
+/*
+ * Methods: setInput, useInputQueue
+ * Usage: state.setInput(in);
+ *        state.useInputQueue();
+ * -----------------------------
+ * Choose where INPUT reads its lines: from a stream, which is not
+ * owned by the state and must outlive it, or from lines handed over
+ * one at a time by queueInput.
+ */
+
+    void setInput(std::istream &stream) {
+        in = &stream;
+    }
+
+    void useInputQueue() {
+        in = nullptr;
+    }
+
+/*
+ * Method: readLine
+ * Usage: if (state.readLine(line)) . . .
+ * --------------------------------------
+ * Reads the next line for INPUT.  Reading a stream waits for the line.
+ * Reading the queue never waits: if it is empty, readLine returns false
+ * and the state is waiting for input until a line has been read, so
+ * that the engine can suspend the program and INPUT can skip its
+ * prompt when it tries again.
+ */
+
+    bool readLine(std::string &line);
+
+/*
+ * Methods: queueInput, hasQueuedInput, waitingForInput, cancelInput
+ * Usage: state.queueInput(line);
+ * -----------------------------------------------------------------
+ * Hand lines to the input queue and report its state.  cancelInput
+ * forgets that INPUT was waiting, as when a new run starts.
+ */
+
+    void queueInput(const std::string &line) {
+        queued.push_back(line);
+    }
+
+    bool hasQueuedInput() const {
+        return !queued.empty();
+    }
+
+    bool waitingForInput() const {
+        return waiting;
+    }
+
+    void cancelInput() {
+        waiting = false;
+    }
+
 private:
 
-    std::map<std::string, int> symbolTable;
+    void grow(int slot);
+
+    Symbols table;                    /* Variable names and slots     */
+    Output out;                       /* Program output               */
+    std::istream *in;                 /* Where INPUT reads, or null   */
+    std::deque<std::string> queued;   /* Lines for INPUT if in is null */
+    bool waiting = false;             /* INPUT found the queue empty  */
+    std::vector<Value> values;        /* Indexed by slot              */
+    std::vector<uint64_t> defined;    /* One bit per slot             */
 
 };
 
@@ -94,7 +285,7 @@ private:
 
 // 构造函数 EvalState()：创建一个新的 EvalState 对象，没有任何变量绑定。
 // 析构函数 ~EvalState()：释放与对象相关的堆存储空间。
-// 私有成员变量 symbolTable 是一个 std::map 类型的对象，用于存储变量名及其对应的值。
+// 私有成员变量 values 按 slot 存储变量的值，defined 是记录变量是否已定义的位图。
 
 // 使用示例：
 // EvalState state;
@@ -113,7 +304,7 @@ private:
 // }
 
 // 代码解释：
-// state定义了一个符号类，将每个数字赋值给一个变量，内部就是用map将string与int关联起来
+// state定义了一个符号类，将每个数字赋值给一个变量，内部先用 Symbols 把变量名映射成 slot，再按 slot 存值
 // setvalue是定义x为10，定义y为5
 // getValue是对这个string进行使用，相当于得到了一个int
 // clear函数用于清空符号表，删除所有已定义的标识符及其对应的值
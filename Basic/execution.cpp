@@ -0,0 +1,62 @@
+/*
+ * File: execution.cpp
+ * -------------------
+ * This file implements the execution.h interface.
+ */
+
+#include "execution.hpp"
+#include "Utils/error.hpp"
+
+Execution::Execution(Program &program, EvalState &state)
+    : program(program), state(state), stepBudget(0), timeBudget(0) {
+    /* Empty */
+}
+
+void Execution::setBudget(long long steps, std::chrono::nanoseconds time) {
+    stepBudget = steps;
+    timeBudget = time;
+    program.setBudget(steps, time);
+}
+
+ExecStatus Execution::run() {
+    program.run(state);
+    return status();
+}
+
+ExecStatus Execution::resume() {
+    if (status() == EXEC_WAITING && !state.hasQueuedInput()) return EXEC_WAITING;
+    program.resume(state);
+    return status();
+}
+
+/*
+ * Implementation notes: resumeJumps
+ * ---------------------------------
+ * The jump limit replaces the budget for one slice only, and the
+ * budget is put back even if the program raises an error.
+ */
+
+ExecStatus Execution::resumeJumps(long long n) {
+    program.setBudget(n, std::chrono::nanoseconds(0));
+    try {
+        ExecStatus result = resume();
+        program.setBudget(stepBudget, timeBudget);
+        return result;
+    } catch (...) {
+        program.setBudget(stepBudget, timeBudget);
+        throw;
+    }
+}
+
+void Execution::provideInput(const std::string &line) {
+    state.queueInput(line);
+}
+
+ExecStatus Execution::status() const {
+    if (!program.isSuspended()) return EXEC_DONE;
+    return state.waitingForInput() ? EXEC_WAITING : EXEC_SUSPENDED;
+}
+
+int Execution::line() const {
+    return program.suspendedLine();
+}
@@ -0,0 +1,137 @@
+/*
+ * File: execution.h
+ * -----------------
+ * This interface exports the Execution class, which runs a program in
+ * slices that can be interleaved with other work on the same thread.
+ */
+
+#ifndef _execution_h
+#define _execution_h
+
+#include <chrono>
+#include <string>
+#include "evalstate.hpp"
+#include "program.hpp"
+
+/*
+ * Type: ExecStatus
+ * ----------------
+ * Where an execution stands after a slice.  EXEC_DONE means there is
+ * nothing to resume: the program ended, was never run, or stopped with
+ * an error.  EXEC_SUSPENDED means the slice ran out of budget, and
+ * EXEC_WAITING that an INPUT found no line to read.
+ */
+
+enum ExecStatus { EXEC_DONE, EXEC_SUSPENDED, EXEC_WAITING };
+
+/*
+ * Class: Execution
+ * ----------------
+ * Runs a program against an evaluation state.  Everything a run needs
+ * in order to go on later is kept outside the C++ stack: the line to
+ * resume at in the program, the variables in the state and the lines
+ * waiting for INPUT in the state's input queue.  A caller can
+ * therefore run a slice, do something else, and resume, which is how
+ * one thread can take turns between many programs.
+ *
+ * If the state reads INPUT from its queue (see EvalState::useInputQueue),
+ * INPUT never waits: it suspends the program until provideInput hands
+ * over a line.  Errors raised by the program are thrown to the caller,
+ * as from Program::run, and end the run.
+ */
+
+class Execution {
+
+public:
+
+/*
+ * Constructor: Execution
+ * Usage: Execution execution(program, state);
+ * -------------------------------------------
+ * Creates an execution of program, which must outlive it, using state
+ * for its variables and I/O.
+ */
+
+    Execution(Program &program, EvalState &state);
+
+/*
+ * Method: setBudget
+ * Usage: execution.setBudget(steps, time);
+ * ----------------------------------------
+ * Sets the budget of the slices that run and resume execute (see
+ * Program::setBudget).
+ */
+
+    void setBudget(long long steps, std::chrono::nanoseconds time);
+
+/*
+ * Method: run
+ * Usage: ExecStatus status = execution.run();
+ * -------------------------------------------
+ * Starts the program from its first line, discarding any run that was
+ * suspended, and executes the first slice.
+ */
+
+    ExecStatus run();
+
+/*
+ * Method: resume
+ * Usage: ExecStatus status = execution.resume();
+ * ----------------------------------------------
+ * Executes the next slice.  A program waiting for input stays waiting,
+ * without running, until a line has been provided.  Reports CAN'T
+ * CONTINUE if there is nothing to resume.
+ */
+
+    ExecStatus resume();
+
+/*
+ * Method: resumeJumps
+ * Usage: ExecStatus status = execution.resumeJumps(n);
+ * ----------------------------------------------------
+ * Like resume, but the slice ends after at most n backward jumps,
+ * whatever the budget.  Backward jumps are what every budget counts
+ * (see Program::setBudget), not statements: the slice stops at the
+ * target of the nth jump, and code without a loop in it runs on to the
+ * end, an INPUT with nothing to read, or the next jump.  As with
+ * resume, there must be a run to continue; call run first.
+ */
+
+    ExecStatus resumeJumps(long long n);
+
+/*
+ * Method: provideInput
+ * Usage: execution.provideInput(line);
+ * ------------------------------------
+ * Queues a line for an INPUT that reads the queue.  The line is read
+ * when the program is next resumed, or by a later INPUT if the program
+ * is not waiting.
+ */
+
+    void provideInput(const std::string &line);
+
+/*
+ * Methods: status, line
+ * Usage: ExecStatus status = execution.status();
+ * ----------------------------------------------
+ * Return the status after the last slice and, unless it is EXEC_DONE,
+ * the number of the line the program resumes at.
+ */
+
+    ExecStatus status() const;
+
+    int line() const;
+
+private:
+
+    Execution(const Execution &) = delete;
+    Execution &operator=(const Execution &) = delete;
+
+    Program &program;                         /* The program being run  */
+    EvalState &state;                         /* Its variables and I/O  */
+    long long stepBudget;                     /* Budget of every slice  */
+    std::chrono::nanoseconds timeBudget;
+
+};
+
+#endif
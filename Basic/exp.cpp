@@ -17,6 +17,43 @@ Expression::Expression() = default;
 
 Expression::~Expression() = default;
 
+/*
+ * Implementation notes: operators
+ * -------------------------------
+ * The spelling table is indexed by Operator and must be kept in the
+ * same order as the enumeration.
+ */
+
+static const char *const OPERATOR_SPELLINGS[] = {
+    "=", "+", "-", "*", "/", "<", ">", "=", "<<", "?"
+};
+
+Operator toOperator(std::string_view token) {
+    if (token.size() != 1) return INVALID_OP;
+    switch (token[0]) {
+        case '=': return ASSIGN_OP;
+        case '+': return ADD_OP;
+        case '-': return SUB_OP;
+        case '*': return MUL_OP;
+        case '/': return DIV_OP;
+        default: return INVALID_OP;
+    }
+}
+
+Operator toComparison(std::string_view token) {
+    if (token.size() != 1) return INVALID_OP;
+    switch (token[0]) {
+        case '<': return LT_OP;
+        case '>': return GT_OP;
+        case '=': return EQ_OP;
+        default: return INVALID_OP;
+    }
+}
+
+std::string operatorToString(Operator op) {
+    return OPERATOR_SPELLINGS[op];
+}
+
 /*
  * Implementation notes: the ConstantExp subclass
  * ----------------------------------------------
@@ -25,22 +62,22 @@ Expression::~Expression() = default;
  * value of state but needs it to match the general prototype for eval.
  */
 
-ConstantExp::ConstantExp(int value) {
+ConstantExp::ConstantExp(Value value) {
     this->value = value;
 }
-int ConstantExp::eval(EvalState &state) {
+Value ConstantExp::eval(EvalState &state) {
     return value;
 }
 
 std::string ConstantExp::toString() {
-    return integerToString(value);
+    return std::to_string(value);
 }
 
 ExpressionType ConstantExp::getType() {
     return CONSTANT;
 }
 
-int ConstantExp::getValue() {
+Value ConstantExp::getValue() {
     return value;
 }
 
@@ -48,17 +85,19 @@ int ConstantExp::getValue() {
  * Implementation notes: the IdentifierExp subclass
  * ------------------------------------------------
  * The IdentifierExp subclass declares a single instance variable that
- * stores the name of the variable.  The implementation of eval must
- * look this variable up in the evaluation state.
+ * stores the name of the variable, together with the slot the name was
+ * interned as.  The implementation of eval looks the slot up in the
+ * evaluation state.
  */
 
-IdentifierExp::IdentifierExp(std::string name) {
+IdentifierExp::IdentifierExp(std::string name, int slot) {
     this->name = name;
+    this->slot = slot;
 }
 
-int IdentifierExp::eval(EvalState &state) {
-    if (!state.isDefined(name)) error("VARIABLE NOT DEFINED");
-    return state.getValue(name);
+Value IdentifierExp::eval(EvalState &state) {
+    if (!state.isDefined(slot)) error("VARIABLE NOT DEFINED");
+    return state.getValue(slot);
 }
 std::string IdentifierExp::toString() {
     return name;
@@ -72,6 +111,10 @@ std::string IdentifierExp::getName() {
     return name;
 }
 
+int IdentifierExp::getSlot() {
+    return slot;
+}
+
 /*
  * Implementation notes: the CompoundExp subclass
  * ----------------------------------------------
@@ -81,14 +124,15 @@ std::string IdentifierExp::getName() {
  */
 
 CompoundExp::CompoundExp(std::string op, Expression *lhs, Expression *rhs) {
-    this->op = op;
+    this->op = toOperator(op);
     this->lhs = lhs;
     this->rhs = rhs;
 }
 
-CompoundExp::~CompoundExp() {
-    delete lhs;
-    delete rhs;
+CompoundExp::CompoundExp(Operator op, Expression *lhs, Expression *rhs) {
+    this->op = op;
+    this->lhs = lhs;
+    this->rhs = rhs;
 }
 
 /*
@@ -99,31 +143,31 @@ CompoundExp::~CompoundExp() {
  * the assignment operator does not evaluate its left operand.
  */
 
-int CompoundExp::eval(EvalState &state) {
-    if (op == "=") {
+Value CompoundExp::eval(EvalState &state) {
+    if (op == ASSIGN_OP) {
         if (lhs->getType() != IDENTIFIER) {
             error("Illegal variable in assignment");
         }
         if (lhs->getType() == IDENTIFIER && lhs->toString() == "LET")
             error("SYNTAX ERROR");
-        int val = rhs->eval(state);
-        state.setValue(((IdentifierExp *) lhs)->getName(), val);
+        Value val = rhs->eval(state);
+        state.setValue(((IdentifierExp *) lhs)->getSlot(), val);
         return val;
     }
-    int left = lhs->eval(state);
-    int right = rhs->eval(state);
-    if (op == "+") return left + right;
-    if (op == "-") return left - right;
-    if (op == "*") return left * right;
-    if (op == "/") {
-        if (right == 0) error("DIVIDE BY ZERO");
-        return left / right;
+    Value left = lhs->eval(state);
+    Value right = rhs->eval(state);
+    switch (op) {
+        case ADD_OP: return addValues(left, right);
+        case SUB_OP: return subValues(left, right);
+        case MUL_OP: return mulValues(left, right);
+        case DIV_OP: return divValues(left, right);
+        case SHL_OP: return shlValue(left, int(right));
+        default: return 0;
     }
-    return 0;
 }
 
 std::string CompoundExp::toString() {
-    return '(' + lhs->toString() + ' ' + op + ' ' + rhs->toString() + ')';
+    return '(' + lhs->toString() + ' ' + operatorToString(op) + ' ' + rhs->toString() + ')';
 }
 
 ExpressionType CompoundExp::getType() {
@@ -131,6 +175,10 @@ ExpressionType CompoundExp::getType() {
 }
 
 std::string CompoundExp::getOp() {
+    return operatorToString(op);
+}
+
+Operator CompoundExp::getOperator() {
     return op;
 }
 
@@ -141,3 +189,77 @@ Expression *CompoundExp::getLHS() {
 Expression *CompoundExp::getRHS() {
     return rhs;
 }
+
+/*
+ * Implementation notes: the specialized CompoundExp subclasses
+ * ------------------------------------------------------------
+ * Each subclass repeats the corresponding case of CompoundExp::eval
+ * with the operator fixed, including the checks on the target of an
+ * assignment and the run-time test for division by zero.
+ */
+
+AssignExp::AssignExp(Expression *lhs, Expression *rhs) : CompoundExp(ASSIGN_OP, lhs, rhs) {}
+
+Value AssignExp::eval(EvalState &state) {
+    if (lhs->getType() != IDENTIFIER) {
+        error("Illegal variable in assignment");
+    }
+    if (lhs->toString() == "LET")
+        error("SYNTAX ERROR");
+    Value val = rhs->eval(state);
+    state.setValue(((IdentifierExp *) lhs)->getSlot(), val);
+    return val;
+}
+
+AddExp::AddExp(Expression *lhs, Expression *rhs) : CompoundExp(ADD_OP, lhs, rhs) {}
+
+Value AddExp::eval(EvalState &state) {
+    Value left = lhs->eval(state);
+    return addValues(left, rhs->eval(state));
+}
+
+SubExp::SubExp(Expression *lhs, Expression *rhs) : CompoundExp(SUB_OP, lhs, rhs) {}
+
+Value SubExp::eval(EvalState &state) {
+    Value left = lhs->eval(state);
+    return subValues(left, rhs->eval(state));
+}
+
+MulExp::MulExp(Expression *lhs, Expression *rhs) : CompoundExp(MUL_OP, lhs, rhs) {}
+
+Value MulExp::eval(EvalState &state) {
+    Value left = lhs->eval(state);
+    return mulValues(left, rhs->eval(state));
+}
+
+DivExp::DivExp(Expression *lhs, Expression *rhs) : CompoundExp(DIV_OP, lhs, rhs) {}
+
+Value DivExp::eval(EvalState &state) {
+    Value left = lhs->eval(state);
+    Value right = rhs->eval(state);
+    return divValues(left, right);
+}
+
+ShlExp::ShlExp(Expression *lhs, Expression *rhs) : CompoundExp(SHL_OP, lhs, rhs) {
+    shift = int(((ConstantExp *) rhs)->getValue());
+}
+
+Value ShlExp::eval(EvalState &state) {
+    return shlValue(lhs->eval(state), shift);
+}
+
+int ShlExp::getShift() {
+    return shift;
+}
+
+CompoundExp *newCompoundExp(Arena &arena, Operator op, Expression *lhs, Expression *rhs) {
+    switch (op) {
+        case ASSIGN_OP: return arena.make<AssignExp>(lhs, rhs);
+        case ADD_OP: return arena.make<AddExp>(lhs, rhs);
+        case SUB_OP: return arena.make<SubExp>(lhs, rhs);
+        case MUL_OP: return arena.make<MulExp>(lhs, rhs);
+        case DIV_OP: return arena.make<DivExp>(lhs, rhs);
+        case SHL_OP: return arena.make<ShlExp>(lhs, rhs);
+        default: return arena.make<CompoundExp>(op, lhs, rhs);
+    }
+}
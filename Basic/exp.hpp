@@ -10,7 +10,9 @@
 #define _exp_h
 
 #include <string>
+#include <string_view>
 #include "Utils/error.hpp"
+#include "arena.hpp"
 #include "evalstate.hpp"
 #include "Utils/strlib.hpp"
 
@@ -25,6 +27,51 @@ enum ExpressionType {
     CONSTANT, IDENTIFIER, COMPOUND
 };
 
+/*
+ * Type: Operator
+ * --------------
+ * This enumerated type identifies a binary operator.  Operator tokens
+ * are resolved to an Operator once, when the line is parsed, so that
+ * neither the evaluator nor the IF statement compares strings at run
+ * time.  The token "=" means ASSIGN_OP inside an expression and EQ_OP
+ * when it is the relational operator of an IF statement.  SHL_OP has
+ * no token; the optimizer introduces it for multiplication by a power
+ * of two.
+ */
+
+enum Operator {
+    ASSIGN_OP, ADD_OP, SUB_OP, MUL_OP, DIV_OP, LT_OP, GT_OP, EQ_OP, SHL_OP, INVALID_OP
+};
+
+/*
+ * Function: toOperator
+ * Usage: Operator op = toOperator(token);
+ * ---------------------------------------
+ * Returns the arithmetic or assignment operator denoted by token, or
+ * INVALID_OP if token is not one.
+ */
+
+Operator toOperator(std::string_view token);
+
+/*
+ * Function: toComparison
+ * Usage: Operator cmp = toComparison(token);
+ * ------------------------------------------
+ * Returns the relational operator (LT_OP, GT_OP or EQ_OP) denoted by
+ * token, or INVALID_OP if token is not one.
+ */
+
+Operator toComparison(std::string_view token);
+
+/*
+ * Function: operatorToString
+ * Usage: string str = operatorToString(op);
+ * -----------------------------------------
+ * Returns the source spelling of op.
+ */
+
+std::string operatorToString(Operator op);
+
 /*
  * Class: Expression
  * -----------------
@@ -63,24 +110,24 @@ public:
 
 /*
  * Destructor: ~Expression
- * Usage: delete exp;
- * ------------------
+ * -----------------------
  * The destructor deallocates the storage for this expression.
  * It must be declared virtual to ensure that the correct subclass
- * destructor is called when deleting an expression.
+ * destructor is called.  Expressions built by the parser live in an
+ * Arena and are destroyed with it, never with delete.
  */
 
     virtual ~Expression();
 
 /*
  * Method: eval
- * Usage: int value = exp->eval(state);
+ * Usage: Value value = exp->eval(state);
  * ------------------------------------
  * Evaluates this expression and returns its value in the context of
  * the specified EvalState object.
  */
 
-    virtual int eval(EvalState &state) = 0;
+    virtual Value eval(EvalState &state) = 0;
 
 /*
  * Method: toString
@@ -121,7 +168,7 @@ public:
  * to the given value.
  */
 
-    ConstantExp(int value);
+    ConstantExp(Value value);
 
 /*
  * Prototypes for the virtual methods
@@ -130,7 +177,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual int eval(EvalState &state);
+    virtual Value eval(EvalState &state);
 
     virtual std::string toString();
 
@@ -138,17 +185,17 @@ public:
 
 /*
  * Method: getValue
- * Usage: int value = ((ConstantExp *) exp)->getValue();
+ * Usage: Value value = ((ConstantExp *) exp)->getValue();
  * -----------------------------------------------------
  * Returns the value field without calling eval and can be applied
  * only to an object known to be a ConstantExp.
  */
 
-    int getValue();
+    Value getValue();
 
 private:
 
-    int value;
+    Value value;
 
 };
 
@@ -164,13 +211,14 @@ public:
 
 /*
  * Constructor: IdentifierExp
- * Usage: Expression *exp = new IdentifierExp(name);
- * -------------------------------------------------
+ * Usage: Expression *exp = new IdentifierExp(name, slot);
+ * -------------------------------------------------------
  * The constructor initializes a new identifier expression
- * for the variable named by name.
+ * for the variable named by name, which the caller has interned as
+ * slot in the table of the state the expression is evaluated in.
  */
 
-    IdentifierExp(std::string name);
+    IdentifierExp(std::string name, int slot);
 
 /*
  * Prototypes for the virtual methods
@@ -179,7 +227,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual int eval(EvalState &state);
+    virtual Value eval(EvalState &state);
 
     virtual std::string toString();
 
@@ -195,9 +243,20 @@ public:
 
     std::string getName();
 
+/*
+ * Method: getSlot
+ * Usage: int slot = ((IdentifierExp *) exp)->getSlot();
+ * -----------------------------------------------------
+ * Returns the slot that the variable name was interned as when the
+ * node was constructed.
+ */
+
+    int getSlot();
+
 private:
 
     std::string name;
+    int slot;
 
 };
 
@@ -218,11 +277,15 @@ public:
  * -------------------------------------------------------
  * The constructor initializes a new compound expression
  * which is composed of the operator (op) and the left and
- * right subexpression (lhs and rhs).
+ * right subexpression (lhs and rhs).  Clients that build trees
+ * for evaluation should use newCompoundExp, which returns the
+ * node class specialized for the operator.
  */
 
     CompoundExp(std::string op, Expression *lhs, Expression *rhs);
 
+    CompoundExp(Operator op, Expression *lhs, Expression *rhs);
+
 /*
  * Prototypes for the virtual methods
  * ----------------------------------
@@ -230,9 +293,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual ~CompoundExp();
-
-    virtual int eval(EvalState &state);
+    virtual Value eval(EvalState &state);
 
     virtual std::string toString();
 
@@ -254,13 +315,115 @@ public:
 
     Expression *getRHS();
 
-private:
+/*
+ * Method: getOperator
+ * Usage: Operator op = ((CompoundExp *) exp)->getOperator();
+ * ----------------------------------------------------------
+ * Returns the operator of a compound node as an Operator value.
+ */
+
+    Operator getOperator();
 
-    std::string op;
+protected:
+
+    Operator op;
     Expression *lhs, *rhs;
 
 };
 
+/*
+ * Classes: AssignExp, AddExp, SubExp, MulExp, DivExp
+ * --------------------------------------------------
+ * These subclasses of CompoundExp each implement eval for exactly one
+ * operator, so evaluating a node never has to dispatch on the operator.
+ */
+
+class AssignExp : public CompoundExp {
+
+public:
+
+    AssignExp(Expression *lhs, Expression *rhs);
+
+    virtual Value eval(EvalState &state);
+
+};
+
+class AddExp : public CompoundExp {
+
+public:
+
+    AddExp(Expression *lhs, Expression *rhs);
+
+    virtual Value eval(EvalState &state);
+
+};
+
+class SubExp : public CompoundExp {
+
+public:
+
+    SubExp(Expression *lhs, Expression *rhs);
+
+    virtual Value eval(EvalState &state);
+
+};
+
+class MulExp : public CompoundExp {
+
+public:
+
+    MulExp(Expression *lhs, Expression *rhs);
+
+    virtual Value eval(EvalState &state);
+
+};
+
+class DivExp : public CompoundExp {
+
+public:
+
+    DivExp(Expression *lhs, Expression *rhs);
+
+    virtual Value eval(EvalState &state);
+
+};
+
+/*
+ * Class: ShlExp
+ * -------------
+ * A left shift by a constant, which the optimizer substitutes for a
+ * multiplication by a power of two.  The right operand must be a
+ * ConstantExp between 0 and 31.  The shift wraps around on overflow
+ * exactly like the multiplication it replaces.
+ */
+
+class ShlExp : public CompoundExp {
+
+public:
+
+    ShlExp(Expression *lhs, Expression *rhs);
+
+    virtual Value eval(EvalState &state);
+
+    int getShift();
+
+private:
+
+    int shift;
+
+};
+
+/*
+ * Function: newCompoundExp
+ * Usage: Expression *exp = newCompoundExp(arena, op, lhs, rhs);
+ * -------------------------------------------------------------
+ * Allocates the CompoundExp subclass that implements op in arena.
+ * A compound node does not own its subexpressions; they must live in
+ * the same arena.
+ */
+
+CompoundExp *newCompoundExp(Arena &arena, Operator op, Expression *lhs, Expression *rhs);
+
 #endif
 
 // 实现了一个表达式求值的功能，
@@ -0,0 +1,483 @@
+/*
+ * File: image.cpp
+ * ---------------
+ * This file implements the image.h interface.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "image.hpp"
+#include "allocstats.hpp"
+#include "loader.hpp"
+#include "optimizer.hpp"
+#include "statement.hpp"
+#include "Utils/error.hpp"
+#include "Utils/tokenScanner.hpp"
+
+/* Marks a line that was saved without code */
+
+static const uint32_t NO_CODE = 0xffffffff;
+
+static void badImage() {
+    error("BAD IMAGE");
+}
+
+/*
+ * Implementation notes: currentFlags, checksums
+ * ---------------------------------------------
+ * The text hash is 64-bit FNV-1a over each line's number and source,
+ * with a newline after each source so that moving text from one line
+ * to the next changes it.  The code hash is the same function applied
+ * to whole words, which is four times as fast and still changes with
+ * any word of the code.
+ */
+
+static uint32_t currentFlags() {
+    return (useInt64 ? IMAGE_INT64 : 0) | (useOptimizer ? IMAGE_OPTIMIZED : 0);
+}
+
+static void hashBytes(uint64_t &hash, const void *data, std::size_t size) {
+    const unsigned char *p = (const unsigned char *) data;
+    for (std::size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+static void hashLine(uint64_t &hash, int32_t number, std::string_view source) {
+    hashBytes(hash, &number, sizeof number);
+    hashBytes(hash, source.data(), source.size());
+    hashBytes(hash, "\n", 1);
+}
+
+static uint64_t hashCode(const uint32_t *code, uint32_t words) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t w;
+        std::memcpy(&w, code + i, sizeof w);
+        hash ^= w;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static const uint64_t HASH_START = 14695981039346656037ULL;
+
+static uint32_t align4(std::size_t n) {
+    return uint32_t((n + 3) & ~std::size_t(3));
+}
+
+/* Implementation of the ImageWriter class */
+
+void ImageWriter::value(Value v) {
+    uint64_t bits = uint64_t(v);
+    word(uint32_t(bits));
+    word(uint32_t(bits >> 32));
+}
+
+void ImageWriter::symbol(const std::string &name) {
+    auto found = indices.find(name);
+    if (found == indices.end()) {
+        found = indices.emplace(name, uint32_t(names.size())).first;
+        names.push_back(name);
+    }
+    word(found->second);
+}
+
+void ImageWriter::expression(Expression *exp) {
+    switch (exp->getType()) {
+        case CONSTANT:
+            word(CONSTANT);
+            value(((ConstantExp *) exp)->getValue());
+            break;
+        case IDENTIFIER:
+            word(IDENTIFIER);
+            symbol(((IdentifierExp *) exp)->getName());
+            break;
+        case COMPOUND: {
+            CompoundExp *cexp = (CompoundExp *) exp;
+            word(COMPOUND);
+            word(cexp->getOperator());
+            expression(cexp->getLHS());
+            expression(cexp->getRHS());
+            break;
+        }
+    }
+}
+
+/* Implementation of the ImageReader class */
+
+ImageReader::ImageReader(const uint32_t *code, uint32_t words, const std::vector<int> &slots,
+                         const std::vector<std::string_view> &names)
+    : code(code), words(words), next(0), slots(slots), names(names) {
+    /* Empty */
+}
+
+void ImageReader::seek(uint32_t position) {
+    if (position >= words) badImage();
+    next = position;
+}
+
+uint32_t ImageReader::word() {
+    if (next >= words) badImage();
+    uint32_t w;
+    std::memcpy(&w, code + next++, sizeof w);
+    return w;
+}
+
+Value ImageReader::value() {
+    uint64_t low = word();
+    uint64_t high = word();
+    return Value(low | high << 32);
+}
+
+std::string_view ImageReader::symbol(int &slot) {
+    uint32_t index = word();
+    if (index >= slots.size()) badImage();
+    slot = slots[index];
+    return names[index];
+}
+
+/*
+ * Implementation notes: ImageReader::expression
+ * ---------------------------------------------
+ * A shift node is only ever made by the optimizer, with a small
+ * constant on the right, and ShlExp relies on that; an image that says
+ * otherwise is rejected rather than trusted, as is one nested more
+ * than MAX_DEPTH deep.
+ */
+
+Expression *ImageReader::expression(Arena &arena) {
+    return expression(arena, 0);
+}
+
+Expression *ImageReader::expression(Arena &arena, int depth) {
+    if (depth >= MAX_DEPTH) badImage();
+    switch (word()) {
+        case CONSTANT:
+            return arena.make<ConstantExp>(value());
+        case IDENTIFIER: {
+            int slot;
+            std::string_view name = symbol(slot);
+            return arena.make<IdentifierExp>(std::string(name), slot);
+        }
+        case COMPOUND: {
+            uint32_t op = word();
+            if (op > INVALID_OP) badImage();
+            Expression *lhs = expression(arena, depth + 1);
+            Expression *rhs = expression(arena, depth + 1);
+            if (op == SHL_OP) {
+                if (rhs->getType() != CONSTANT) badImage();
+                Value shift = ((ConstantExp *) rhs)->getValue();
+                if (shift < 0 || shift > 31) badImage();
+            }
+            return newCompoundExp(arena, Operator(op), lhs, rhs);
+        }
+        default:
+            badImage();
+            return nullptr;
+    }
+}
+
+/*
+ * Implementation notes: buildImage
+ * --------------------------------
+ * The sections are laid out in the order of the header.  Symbols are
+ * only known once every statement has been written, so their names go
+ * into the text section after the sources, followed by the path of
+ * the source file.
+ */
+
+std::string buildImage(const Program &program) {
+    return buildImage(program, program.sourceFile());
+}
+
+std::string buildImage(const Program &program, const SourceFile &source) {
+    ImageWriter out;
+    std::vector<ImageLine> lines;
+    std::string text;
+    uint64_t hash = HASH_START;
+    lines.reserve(program.size());
+    for (int i = 0; i < program.size(); i++) {
+        const LineRecord &rec = program.lineAt(i);
+        ImageLine line;
+        line.number = rec.number;
+        line.textOffset = uint32_t(text.size());
+        line.length = uint32_t(rec.source.size());
+        line.code = NO_CODE;
+        if (rec.stmt != nullptr) {
+            line.code = out.position();
+            rec.stmt->save(out);
+        }
+        text += rec.source;
+        hashLine(hash, rec.number, rec.source);
+        lines.push_back(line);
+    }
+    std::vector<ImageSymbol> symbols;
+    for (const std::string &name : out.names) {
+        symbols.push_back({uint32_t(text.size()), uint32_t(name.size())});
+        text += name;
+    }
+    uint32_t sourcePath = uint32_t(text.size());
+    text += source.path;
+
+    ImageHeader header;
+    std::memcpy(header.magic, IMAGE_MAGIC, sizeof header.magic);
+    header.version = IMAGE_VERSION;
+    header.flags = currentFlags();
+    header.textHash = hash;
+    header.sourceSize = source.size;
+    header.sourceModified = source.modified;
+    header.sourcePath = sourcePath;
+    header.sourcePathLength = uint32_t(source.path.size());
+    header.symbolCount = uint32_t(symbols.size());
+    header.lineCount = uint32_t(lines.size());
+    std::size_t size = align4(sizeof header);
+    header.symbolOffset = uint32_t(size);
+    size += symbols.size() * sizeof(ImageSymbol);
+    header.lineOffset = uint32_t(size);
+    size += lines.size() * sizeof(ImageLine);
+    header.textOffset = uint32_t(size);
+    size = align4(size + text.size());
+    header.codeOffset = uint32_t(size);
+    header.codeWords = out.position();
+    header.codeHash = hashCode(out.code.data(), header.codeWords);
+    size += out.code.size() * sizeof(uint32_t);
+    if (size > UINT32_MAX) error("PROGRAM TOO LARGE");
+    header.size = uint32_t(size);
+
+    std::string image(size, '\0');
+    std::memcpy(&image[0], &header, sizeof header);
+    if (!symbols.empty()) {
+        std::memcpy(&image[header.symbolOffset], symbols.data(), symbols.size() * sizeof(ImageSymbol));
+    }
+    if (!lines.empty()) {
+        std::memcpy(&image[header.lineOffset], lines.data(), lines.size() * sizeof(ImageLine));
+    }
+    if (!text.empty()) std::memcpy(&image[header.textOffset], text.data(), text.size());
+    if (!out.code.empty()) {
+        std::memcpy(&image[header.codeOffset], out.code.data(), out.code.size() * sizeof(uint32_t));
+    }
+    return image;
+}
+
+void saveImage(const std::string &filename, const Program &program) {
+    SourceFile target;
+    bool replacesSource = describeFile(filename, target)
+                          && target.path == program.sourceFile().path;
+    std::string image = replacesSource ? buildImage(program, SourceFile())
+                                       : buildImage(program);
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) error("CANNOT WRITE FILE");
+    std::size_t written = 0;
+    while (written < image.size()) {
+        ssize_t n = ::write(fd, image.data() + written, image.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            error("CANNOT WRITE FILE");
+        }
+        written += std::size_t(n);
+    }
+    if (::close(fd) < 0) error("CANNOT WRITE FILE");
+}
+
+bool isImage(std::string_view data) {
+    return data.size() >= sizeof(ImageHeader)
+           && std::memcmp(data.data(), IMAGE_MAGIC, sizeof IMAGE_MAGIC) == 0;
+}
+
+/*
+ * Implementation notes: reparse
+ * -----------------------------
+ * Does for one stored line what processLine does with a numbered line,
+ * including reporting the error of a line that does not parse.  The
+ * statement is made in arena, whose index among the program's arenas
+ * is index.
+ */
+
+static void reparse(LineRecord &rec, Arena &arena, int index, EvalState &state) {
+    AllocScope scope(ALLOC_PARSER);
+    TokenScanner scanner;
+    scanner.ignoreWhitespace();
+    scanner.scanNumbers();
+    scanner.setInputView(rec.source);
+    rec.stmt = nullptr;
+    try {
+        scanner.nextTokenView();
+        Keyword keyword = lookupKeyword(scanner.nextTokenView().text);
+        rec.stmt = parseStatement(keyword, scanner, arena, state);
+        if (rec.stmt != nullptr) rec.arena = index;
+    } catch (ErrorException &ex) {
+        state.output() << ex.getMessage() << '\n';
+        rec.stmt = nullptr;
+    } catch (std::exception &) {
+        state.output() << "SYNTAX ERROR\n";
+        rec.stmt = nullptr;
+    }
+}
+
+/*
+ * Implementation notes: loadImageData
+ * -----------------------------------
+ * Everything in the header is checked against the size of the image
+ * before anything is read, and the line table is checked to be in
+ * order and the text and code against their checksums, so a damaged
+ * image is reported instead of being trusted.  The source file is
+ * only looked at if it still exists: an image whose source has been
+ * removed is all that is left of the program.
+ * Every symbol is interned up front, so the threads that rebuild the
+ * statements share nothing but the image; like the loader, they claim
+ * batches of lines from a shared counter.  The first error a thread
+ * meets is raised once they have all finished, and the program is
+ * only replaced once every line has been rebuilt.
+ */
+
+static bool within(uint32_t offset, uint64_t size, uint32_t limit) {
+    return offset % 4 == 0 && offset <= limit && size <= limit - offset;
+}
+
+void loadImageData(std::string_view data, Program &program, EvalState &state, int jobs) {
+    AllocScope scope(ALLOC_PROGRAM);
+    if (!isImage(data)) badImage();
+    ImageHeader header;
+    std::memcpy(&header, data.data(), sizeof header);
+    if (header.version != IMAGE_VERSION) error("IMAGE VERSION MISMATCH");
+    if (header.size != data.size()) badImage();
+    uint32_t limit = header.size;
+    if (!within(header.symbolOffset, uint64_t(header.symbolCount) * sizeof(ImageSymbol), limit)
+        || !within(header.lineOffset, uint64_t(header.lineCount) * sizeof(ImageLine), limit)
+        || header.textOffset > limit
+        || !within(header.codeOffset, uint64_t(header.codeWords) * sizeof(uint32_t), limit)) {
+        badImage();
+    }
+    const char *base = data.data();
+    std::string_view text(base + header.textOffset, limit - header.textOffset);
+    auto textAt = [&](uint32_t offset, uint32_t length) {
+        if (offset > text.size() || length > text.size() - offset) badImage();
+        return text.substr(offset, length);
+    };
+
+    const ImageLine *lines = (const ImageLine *) (base + header.lineOffset);
+    uint64_t hash = HASH_START;
+    for (uint32_t i = 0; i < header.lineCount; i++) {
+        if (i > 0 && lines[i].number <= lines[i - 1].number) badImage();
+        hashLine(hash, lines[i].number, textAt(lines[i].textOffset, lines[i].length));
+    }
+    if (hash != header.textHash) badImage();
+    const uint32_t *code = (const uint32_t *) (base + header.codeOffset);
+    if (hashCode(code, header.codeWords) != header.codeHash) badImage();
+
+    SourceFile source;
+    if (header.sourcePathLength > 0) {
+        source.path = std::string(textAt(header.sourcePath, header.sourcePathLength));
+        source.size = header.sourceSize;
+        source.modified = header.sourceModified;
+        SourceFile current;
+        if (describeFile(source.path, current)
+            && (current.size != source.size || current.modified != source.modified)) {
+            error("STALE IMAGE");
+        }
+    }
+
+    const ImageSymbol *symbols = (const ImageSymbol *) (base + header.symbolOffset);
+    std::vector<std::string_view> names(header.symbolCount);
+    std::vector<int> slots(header.symbolCount);
+    for (uint32_t i = 0; i < header.symbolCount; i++) {
+        names[i] = textAt(symbols[i].textOffset, symbols[i].length);
+        slots[i] = state.symbols().intern(std::string(names[i]));
+    }
+
+    bool compiled = header.flags == currentFlags();
+    std::size_t n = header.lineCount;
+    std::vector<LineRecord> records(n);
+    std::size_t batches = (n + LOAD_BATCH_SIZE - 1) / LOAD_BATCH_SIZE;
+    std::vector<std::unique_ptr<Arena>> arenas(batches + 1);
+    std::atomic<std::size_t> next(0);
+    std::mutex lock;
+    std::exception_ptr failure;
+    auto work = [&]() {
+        AllocScope workerScope(ALLOC_PROGRAM);
+        ImageReader in(code, header.codeWords, slots, names);
+        try {
+            while (true) {
+                std::size_t begin = next.fetch_add(LOAD_BATCH_SIZE);
+                if (begin >= n) break;
+                std::size_t end = std::min(n, begin + LOAD_BATCH_SIZE);
+                std::size_t batch = begin / LOAD_BATCH_SIZE;
+                arenas[batch] = std::make_unique<Arena>();
+                for (std::size_t i = begin; i < end; i++) {
+                    LineRecord &rec = records[i];
+                    rec.number = lines[i].number;
+                    rec.arena = -1;
+                    rec.source = std::string(textAt(lines[i].textOffset, lines[i].length));
+                    rec.stmt = nullptr;
+                    if (!compiled || lines[i].code == NO_CODE) continue;
+                    in.seek(lines[i].code);
+                    rec.stmt = loadStatement(in, *arenas[batch]);
+                    if (rec.stmt != nullptr) rec.arena = int(batch);
+                }
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!failure) failure = std::current_exception();
+            next = n;
+        }
+    };
+    int threads = chooseLoadThreads(jobs, n);
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) pool.emplace_back(work);
+    work();
+    for (std::thread &thread : pool) thread.join();
+    if (failure) std::rethrow_exception(failure);
+    for (LineRecord &rec : records) {
+        if (rec.stmt != nullptr) continue;
+        if (arenas[batches] == nullptr) arenas[batches] = std::make_unique<Arena>();
+        reparse(rec, *arenas[batches], int(batches), state);
+    }
+    program.setLines(std::move(records), std::move(arenas));
+    program.setSourceFile(source);
+}
+
+/*
+ * Implementation notes: loadImage
+ * -------------------------------
+ * The magic number is read first, so that a source file is never
+ * mapped; an image is mapped read-only and unmapped once its lines
+ * have been copied out, whether or not that succeeded.
+ */
+
+bool loadImage(const std::string &filename, Program &program, EvalState &state, int jobs) {
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    char magic[sizeof IMAGE_MAGIC];
+    struct stat st;
+    if (::pread(fd, magic, sizeof magic, 0) != ssize_t(sizeof magic)
+        || std::memcmp(magic, IMAGE_MAGIC, sizeof magic) != 0
+        || ::fstat(fd, &st) < 0 || std::size_t(st.st_size) < sizeof(ImageHeader)) {
+        ::close(fd);
+        return false;
+    }
+    std::size_t size = std::size_t(st.st_size);
+    void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) error("CANNOT READ FILE");
+    try {
+        loadImageData(std::string_view((const char *) mapped, size), program, state, jobs);
+    } catch (...) {
+        ::munmap(mapped, size);
+        throw;
+    }
+    ::munmap(mapped, size);
+    return true;
+}
@@ -0,0 +1,270 @@
+/*
+ * File: image.h
+ * -------------
+ * This interface exports functions that save a program as a binary
+ * image and load it back without scanning or parsing its lines, along
+ * with the classes that statements use to write and read their part
+ * of an image.
+ */
+
+#ifndef _image_h
+#define _image_h
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "arena.hpp"
+#include "evalstate.hpp"
+#include "exp.hpp"
+#include "program.hpp"
+
+/*
+ * Image format
+ * ------------
+ * An image starts with an ImageHeader and holds four sections, each at
+ * an offset given in the header and aligned to four bytes:
+ *
+ *   symbols  one ImageSymbol per variable name the code refers to
+ *   lines    one ImageLine per program line, in line number order
+ *   text     the names of the symbols, the source of every line and
+ *            the path of the file the program was loaded from
+ *   code     the statements, as 32-bit words (see Statement::save)
+ *
+ * Code refers to variables by their index in the symbol section; the
+ * loader interns each name once and maps the indices to the slots of
+ * the state it loads into, which is the only fix-up an image needs.  Branch
+ * targets are line numbers and are resolved when the program is
+ * linked, as for a program that was typed in.
+ *
+ * textHash and codeHash are checksums of the line table and sources
+ * and of the code, and an image that does not match them is damaged.
+ * If the program was loaded from a file that has not been edited
+ * since, the image records that file's path, size and modification
+ * time, and is stale once the file exists with a different size or
+ * time: the program the file holds is no longer the one in the image.
+ * An image saved by a build with different settings (the value width
+ * or the optimizer) is still accepted, but its lines are parsed again
+ * from the sources, since their code would no longer be what parsing
+ * them produces.  All numbers are in the byte order of the machine.
+ */
+
+const char IMAGE_MAGIC[8] = { 'B', 'A', 'S', 'I', 'C', 'I', 'M', 'G' };
+const uint32_t IMAGE_VERSION = 2;
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;             /* IMAGE_INT64 | IMAGE_OPTIMIZED      */
+    uint64_t textHash;          /* Of the line numbers and sources    */
+    uint64_t codeHash;          /* Of the code section                */
+    uint64_t sourceSize;        /* Of the file the program came from  */
+    int64_t sourceModified;     /* Its modification time, in ns       */
+    uint32_t sourcePath;        /* Offset of its path in the text     */
+    uint32_t sourcePathLength;  /* 0 if there is no such file         */
+    uint32_t symbolCount;
+    uint32_t lineCount;
+    uint32_t symbolOffset;
+    uint32_t lineOffset;
+    uint32_t textOffset;
+    uint32_t codeOffset;
+    uint32_t codeWords;
+    uint32_t size;              /* Of the whole image, in bytes       */
+};
+
+enum ImageFlags { IMAGE_INT64 = 1, IMAGE_OPTIMIZED = 2 };
+
+struct ImageSymbol {
+    uint32_t textOffset;
+    uint32_t length;
+};
+
+struct ImageLine {
+    int32_t number;
+    uint32_t textOffset;
+    uint32_t length;
+    uint32_t code;              /* Index of the first word            */
+};
+
+/*
+ * Class: ImageWriter
+ * ------------------
+ * Collects the code words of the statements being saved.  Statements
+ * write a Keyword followed by their operands; expressions and variable
+ * names have methods of their own.
+ */
+
+class ImageWriter {
+
+public:
+
+/*
+ * Methods: word, value, symbol, expression
+ * Usage: out.word(KW_GOTO);
+ * -------------------------
+ * Append a word, a value (two words), the symbol index of a variable
+ * name, or an expression tree in prefix order.
+ */
+
+    void word(uint32_t w) {
+        code.push_back(w);
+    }
+
+    void value(Value v);
+
+    void symbol(const std::string &name);
+
+    void expression(Expression *exp);
+
+/*
+ * Method: position
+ * Usage: uint32_t start = out.position();
+ * ---------------------------------------
+ * Returns the index of the next word to be written.
+ */
+
+    uint32_t position() const {
+        return uint32_t(code.size());
+    }
+
+private:
+
+    friend std::string buildImage(const Program &program, const SourceFile &source);
+
+    std::vector<uint32_t> code;
+    std::vector<std::string> names;                 /* By symbol index */
+    std::unordered_map<std::string, uint32_t> indices;
+
+};
+
+/*
+ * Class: ImageReader
+ * ------------------
+ * Reads the code of one statement back.  Every method checks that it
+ * stays inside the code section and that what it reads makes sense,
+ * and reports BAD IMAGE otherwise.
+ */
+
+class ImageReader {
+
+public:
+
+    ImageReader(const uint32_t *code, uint32_t words, const std::vector<int> &slots,
+                const std::vector<std::string_view> &names);
+
+/*
+ * Method: seek
+ * Usage: in.seek(line.code);
+ * --------------------------
+ * Moves to the code word at index position.
+ */
+
+    void seek(uint32_t position);
+
+/*
+ * Methods: word, value, symbol, expression
+ * Usage: Keyword keyword = Keyword(in.word());
+ * -------------------------------------------
+ * Read what the corresponding ImageWriter methods wrote.  symbol
+ * returns the variable's name and sets slot to its slot in this
+ * process; expression makes the tree in arena.
+ */
+
+    uint32_t word();
+
+    Value value();
+
+    std::string_view symbol(int &slot);
+
+    Expression *expression(Arena &arena);
+
+/*
+ * Constant: MAX_DEPTH
+ * -------------------
+ * The deepest expression tree an image may hold.  Trees are read
+ * recursively, so a deeper one is reported as BAD IMAGE rather than
+ * allowed to exhaust the stack of the thread reading it.
+ */
+
+    static const int MAX_DEPTH = 16384;
+
+private:
+
+    Expression *expression(Arena &arena, int depth);
+
+    const uint32_t *code;
+    uint32_t words;
+    uint32_t next;
+    const std::vector<int> &slots;
+    const std::vector<std::string_view> &names;
+
+};
+
+/*
+ * Function: saveImage
+ * Usage: saveImage(filename, program);
+ * ------------------------------------
+ * Writes program to the named file as an image.  The file the program
+ * was loaded from is not recorded if the image replaces it, since it
+ * would then be stale as soon as it was written.  Raises an error if
+ * the file cannot be written.
+ */
+
+void saveImage(const std::string &filename, const Program &program);
+
+/*
+ * Function: buildImage
+ * Usage: std::string image = buildImage(program);
+ *        std::string image = buildImage(program, source);
+ * -------------------------------------------------------
+ * Returns the image saveImage would write, recording source as the
+ * file the program came from.  source defaults to the program's own
+ * (see Program::sourceFile).
+ */
+
+std::string buildImage(const Program &program);
+
+std::string buildImage(const Program &program, const SourceFile &source);
+
+/*
+ * Function: loadImage
+ * Usage: if (loadImage(filename, program, state)) . . .
+ *        if (loadImage(filename, program, state, jobs)) . . .
+ * -----------------------------------------------------------
+ * If the named file is an image, maps it into memory, replaces program
+ * with the lines it holds and returns true.  Lines are rebuilt on up to
+ * jobs threads, chosen as by loadProgram.  Lines saved without code,
+ * such as lines that failed to parse, are parsed again from their
+ * source, in order and on the calling thread, and report their errors
+ * as they did when they were entered.  Returns false, leaving program
+ * alone, if the file is not an image; raises an error if it is one
+ * that cannot be used, which includes one whose source file has
+ * changed since it was saved (STALE IMAGE).  The program loaded keeps
+ * the image's source file, so saving it again records the file too.
+ */
+
+bool loadImage(const std::string &filename, Program &program, EvalState &state,
+               int jobs = 0);
+
+/*
+ * Function: loadImageData
+ * Usage: loadImageData(data, program, state, jobs);
+ * -------------------------------------------------
+ * Works like loadImage on an image that is already in memory.  data
+ * must be aligned to four bytes.
+ */
+
+void loadImageData(std::string_view data, Program &program, EvalState &state,
+                   int jobs = 0);
+
+/*
+ * Function: isImage
+ * Usage: if (isImage(data)) . . .
+ * -------------------------------
+ * Returns true if data starts like an image.
+ */
+
+bool isImage(std::string_view data);
+
+#endif
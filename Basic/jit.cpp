@@ -0,0 +1,624 @@
+/*
+ * File: jit.cpp
+ * -------------
+ * This file implements JitCode, a template compiler from threaded code
+ * to x86-64 machine code.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include "jit.hpp"
+#include "allocstats.hpp"
+#include "evalstate.hpp"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+bool useJit = true;
+
+/*
+ * Implementation notes: JitFrame
+ * ------------------------------
+ * The single argument of every native function.  It tells the code
+ * where the variables are and how many backward jumps it may take, and
+ * receives the operand stack when the code exits in the middle of an
+ * expression.
+ */
+
+static const int JIT_STACK_SLOTS = 6;
+
+struct JitFrame {
+    Value *values;
+    EvalState *state;
+    long long budget;
+    int jump;                           /* Jump that used up the budget */
+    int sp;
+    int stack[JIT_STACK_SLOTS];
+};
+
+typedef int (*JitFunction)(JitFrame *frame);
+
+/*
+ * Implementation notes: JitRegion
+ * -------------------------------
+ * One compiled loop: the executable mapping that holds its code, and
+ * the slots it uses, which must all be defined before it is entered.
+ */
+
+struct JitRegion {
+    JitFunction function;
+    void *memory;
+    size_t size;
+    std::vector<int> slots;
+};
+
+JitCode::JitCode(const std::vector<ThreadedInstruction> &code) : code(code) {
+    counts.assign(code.size(), 0);
+    regions.assign(code.size(), nullptr);
+}
+
+JitCode::~JitCode() {
+    for (JitRegion *region : regions) {
+        if (region == nullptr) continue;
+#if JIT_SUPPORTED
+        munmap(region->memory, region->size);
+#endif
+        delete region;
+    }
+}
+
+bool JitCode::supported() {
+    return JIT_SUPPORTED != 0;
+}
+
+int JitCode::enter(int target, int source, EvalState &state, Value *stack, int &sp,
+                   long long &budget, int &jump) {
+    JitRegion *region = regions[target];
+    if (region == nullptr) {
+        if (counts[target] < 0 || ++counts[target] < JIT_THRESHOLD) return -1;
+        region = compile(target, source + 1);
+        if (region == nullptr) {
+            counts[target] = -1;
+            return -1;
+        }
+        regions[target] = region;
+    }
+    for (int slot : region->slots) {
+        if (!state.isDefined(slot)) return -1;
+    }
+    JitFrame frame;
+    frame.values = state.valueArray();
+    frame.state = &state;
+    frame.budget = budget;
+    frame.jump = jump;
+    frame.sp = 0;
+    int pc = region->function(&frame);
+    budget = frame.budget;
+    jump = frame.jump;
+    std::copy(frame.stack, frame.stack + frame.sp, stack);
+    sp = frame.sp;
+    return pc;
+}
+
+#if JIT_SUPPORTED
+
+/*
+ * Implementation notes: registers
+ * -------------------------------
+ * The four most used variables of a region live in the callee-saved
+ * registers rbx and r12-r14; the others stay in the value array, which
+ * rbp points to.  Values are 64 bits wide in memory but always fit in
+ * 32 bits in the mode the JIT is used in, so the code reads the low
+ * half of a value and sign-extends whatever it writes back.  r15 holds the frame.  Operand stack entries are kept
+ * in six caller-saved registers, leaving rax and rdx as scratch
+ * registers for division and fused instructions.  rcx holds the
+ * budget of backward jumps, which is written back to the frame on
+ * every exit and around calls.
+ */
+
+enum Register {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+static const Register VARIABLE_REGISTERS[] = { RBX, R12, R13, R14 };
+static const int VARIABLE_REGISTER_COUNT = 4;
+static const Register STACK_REGISTERS[JIT_STACK_SLOTS] = { R8, R9, R10, R11, RSI, RDI };
+
+/*
+ * Implementation notes: Operand
+ * -----------------------------
+ * A 32-bit operand of an instruction: either a register or a memory
+ * word at a 32-bit displacement from a base register.
+ */
+
+struct Operand {
+    bool memory;
+    int reg;
+    int disp;
+};
+
+static Operand reg(int r) {
+    return {false, r, 0};
+}
+
+static Operand mem(int base, int disp) {
+    return {true, base, disp};
+}
+
+/*
+ * Implementation notes: Assembler
+ * -------------------------------
+ * Encodes the few x86-64 instructions the compiler needs.  Memory
+ * operands always use a 32-bit displacement, which is valid for every
+ * base register except rsp and r12, and those are never used as bases.
+ */
+
+class Assembler {
+
+public:
+
+    std::vector<uint8_t> bytes;
+
+    void byte(int b) {
+        bytes.push_back(uint8_t(b));
+    }
+
+    void word(int32_t w) {
+        for (int i = 0; i < 4; i++) byte((uint32_t(w) >> (8 * i)) & 0xff);
+    }
+
+    int position() const {
+        return int(bytes.size());
+    }
+
+    void patch(int at, int32_t w) {
+        for (int i = 0; i < 4; i++) bytes[at + i] = uint8_t((uint32_t(w) >> (8 * i)) & 0xff);
+    }
+
+    void rm(std::initializer_list<int> opcode, int field, Operand op, bool wide = false) {
+        int rex = (wide ? 8 : 0) | ((field >> 3) << 2) | (op.reg >> 3);
+        if (rex != 0) byte(0x40 | rex);
+        for (int b : opcode) byte(b);
+        if (op.memory) {
+            byte(0x80 | ((field & 7) << 3) | (op.reg & 7));
+            word(op.disp);
+        } else {
+            byte(0xc0 | ((field & 7) << 3) | (op.reg & 7));
+        }
+    }
+
+    void load(int dst, Operand src) { rm({0x8b}, dst, src); }
+    void store(Operand dst, int src) { rm({0x89}, src, dst); }
+    void loadPointer(int dst, Operand src) { rm({0x8b}, dst, src, true); }
+    void add(Operand dst, int src) { rm({0x01}, src, dst); }
+    void sub(Operand dst, int src) { rm({0x29}, src, dst); }
+    void cmp(Operand dst, int src) { rm({0x39}, src, dst); }
+    void test(Operand dst, int src) { rm({0x85}, src, dst); }
+    void imul(int dst, Operand src) { rm({0x0f, 0xaf}, dst, src); }
+    void idiv(Operand src) { rm({0xf7}, 7, src); }
+    void neg(Operand dst) { rm({0xf7}, 3, dst); }
+    void decWide(Operand dst) { rm({0xff}, 1, dst, true); }
+    void signExtend(int dst, Operand src) { rm({0x63}, dst, src, true); }
+    void storeWide(Operand dst, int src) { rm({0x89}, src, dst, true); }
+    void cdq() { byte(0x99); }
+
+    void addImmediate(Operand dst, int32_t imm) {
+        rm({0x81}, 0, dst);
+        word(imm);
+    }
+
+    void cmpImmediate(Operand dst, int32_t imm) {
+        rm({0x81}, 7, dst);
+        word(imm);
+    }
+
+    void moveImmediate(Operand dst, int32_t imm) {
+        rm({0xc7}, 0, dst);
+        word(imm);
+    }
+
+    void shlImmediate(Operand dst, int count) {
+        rm({0xc1}, 4, dst);
+        byte(count);
+    }
+
+/* Memory operands of move are values, so stores to them are 64 bits. */
+
+    void move(Operand dst, Operand src) {
+        if (dst.memory) {
+            signExtend(RAX, src);
+            storeWide(dst, RAX);
+        } else if (!src.memory && src.reg == dst.reg) {
+            return;
+        } else {
+            load(dst.reg, src);
+        }
+    }
+
+    void push(int r) {
+        if (r >= 8) byte(0x41);
+        byte(0x50 | (r & 7));
+    }
+
+    void pop(int r) {
+        if (r >= 8) byte(0x41);
+        byte(0x58 | (r & 7));
+    }
+
+    void call(const void *function) {
+        byte(0x48);
+        byte(0xb8);
+        uint64_t address = uint64_t(uintptr_t(function));
+        for (int i = 0; i < 8; i++) byte((address >> (8 * i)) & 0xff);
+        byte(0xff);
+        byte(0xd0);
+    }
+
+/* Emits a jump with a zero displacement and returns where it goes. */
+
+    int jump() {
+        byte(0xe9);
+        word(0);
+        return position() - 4;
+    }
+
+    int jumpIf(int condition) {
+        byte(0x0f);
+        byte(0x80 | condition);
+        word(0);
+        return position() - 4;
+    }
+
+};
+
+static const int CC_EQ = 0x4;
+static const int CC_NE = 0x5;
+static const int CC_LT = 0xc;
+static const int CC_GT = 0xf;
+
+/*
+ * Implementation notes: jitPrint
+ * ------------------------------
+ * Called from native code for PRINT.  It must not throw, because there
+ * is no unwind information for the native frames.
+ */
+
+static void jitPrint(EvalState *state, int value) noexcept {
+    state->output() << value << '\n';
+}
+
+/*
+ * Implementation notes: RegionCompiler
+ * ------------------------------------
+ * Compiles one region in a single pass.  The depth of the operand stack
+ * at each instruction is known statically, so entry k of the stack is
+ * simply STACK_REGISTERS[k].  Jumps inside the region go to the native
+ * code of their target; every other way out goes through an exit stub,
+ * one per distinct (position, depth) pair, placed after the body.
+ */
+
+class RegionCompiler {
+
+public:
+
+    RegionCompiler(const std::vector<ThreadedInstruction> &code, int start, int end)
+        : code(code), start(start), end(end) {}
+
+    bool compile(JitRegion &region);
+
+    const std::vector<uint8_t> &bytes() const {
+        return as.bytes;
+    }
+
+private:
+
+    struct Fixup {
+        int at;
+        int target;                         /* Position in the region   */
+    };
+
+    Operand variable(int slot) const {
+        auto it = registers.find(slot);
+        if (it != registers.end()) return reg(it->second);
+        return mem(RBP, 8 * slot);
+    }
+
+    static Operand stackEntry(int index) {
+        return reg(STACK_REGISTERS[index]);
+    }
+
+    void allocateRegisters(JitRegion &region);
+    bool body();
+    void exitTo(int at, int pc, int sp);
+    void branch(int at, int target, int pc, int sp);
+    void jumpTo(int condition, int target, int pc, int sp);
+    void emitExits();
+
+    const std::vector<ThreadedInstruction> &code;
+    int start, end;
+    Assembler as;
+    std::map<int, int> registers;           /* Slot to register         */
+    std::vector<int> offsets;               /* Native offset per pc     */
+    std::vector<Fixup> fixups;
+    std::map<std::pair<int, int>, std::vector<int>> exits;
+    int epilogue = 0;
+
+};
+
+static void uses(const ThreadedInstruction &in, std::map<int, int> &count) {
+    switch (in.op) {
+        case OP_LOAD: case OP_ASSIGN: case OP_LET:
+            count[in.a]++;
+            break;
+        case OP_ADD_CONST:
+            count[in.a]++;
+            count[in.b]++;
+            break;
+        case OP_IF_CONST_LT: case OP_IF_CONST_GT: case OP_IF_CONST_EQ:
+            count[in.a]++;
+            break;
+        default:
+            break;
+    }
+}
+
+void RegionCompiler::allocateRegisters(JitRegion &region) {
+    std::map<int, int> count;
+    for (int pc = start; pc < end; pc++) uses(code[pc], count);
+    std::vector<std::pair<int, int>> ranked;
+    for (auto &entry : count) {
+        region.slots.push_back(entry.first);
+        ranked.push_back({-entry.second, entry.first});
+    }
+    std::sort(ranked.begin(), ranked.end());
+    for (int i = 0; i < int(ranked.size()) && i < VARIABLE_REGISTER_COUNT; i++) {
+        registers[ranked[i].second] = VARIABLE_REGISTERS[i];
+    }
+}
+
+void RegionCompiler::exitTo(int at, int pc, int sp) {
+    exits[{pc, sp}].push_back(at);
+}
+
+void RegionCompiler::branch(int at, int target, int pc, int sp) {
+    if (target >= start && target < end) {
+        fixups.push_back({at, target - start});
+    } else if (target < 0) {
+        exitTo(at, pc, sp);
+    } else {
+        exitTo(at, target, 0);
+    }
+}
+
+/*
+ * Implementation notes: jumpTo
+ * ----------------------------
+ * Emits a jump to target, taken when condition holds, or always if
+ * condition is -1.  A backward jump inside the region first takes one
+ * from the budget in rcx and leaves the region at target when that
+ * reaches zero.  A backward jump that leaves the region takes one as
+ * well, since the interpreter resumes at its target without going
+ * through its own back edge; the caller sees the budget at zero and
+ * suspends there.  Either way the jump stores its position in the
+ * frame before it leaves, so that the caller can tell which line it
+ * went to.  The inverse of an x86 condition code is the code
+ * with its lowest bit flipped.
+ */
+
+void RegionCompiler::jumpTo(int condition, int target, int pc, int sp) {
+    if (target < 0 || target >= end || target > pc) {
+        branch(condition < 0 ? as.jump() : as.jumpIf(condition), target, pc, sp);
+        return;
+    }
+    int skip = condition < 0 ? -1 : as.jumpIf(condition ^ 1);
+    as.decWide(reg(RCX));
+    if (target >= start) fixups.push_back({as.jumpIf(CC_NE), target - start});
+    as.moveImmediate(mem(R15, offsetof(JitFrame, jump)), pc);
+    exitTo(as.jump(), target, 0);
+    if (skip >= 0) as.patch(skip, as.position() - (skip + 4));
+}
+
+/*
+ * Implementation notes: body
+ * --------------------------
+ * Returns false if the region uses more stack entries than there are
+ * registers for, or calls PRINT with other entries still live.
+ * Division by -1 is done by negation, which wraps INT_MIN around as the
+ * interpreter does, where idiv would trap.
+ */
+
+bool RegionCompiler::body() {
+    int sp = 0;
+    for (int pc = start; pc < end; pc++) {
+        const ThreadedInstruction &in = code[pc];
+        offsets.push_back(as.position());
+        switch (in.op) {
+            case OP_CONST:
+                if (sp >= JIT_STACK_SLOTS) return false;
+                as.moveImmediate(stackEntry(sp++), in.a);
+                break;
+            case OP_LOAD:
+                if (sp >= JIT_STACK_SLOTS) return false;
+                as.move(stackEntry(sp++), variable(in.a));
+                break;
+            case OP_ASSIGN:
+                as.move(variable(in.a), stackEntry(sp - 1));
+                break;
+            case OP_LET:
+                as.move(variable(in.a), stackEntry(--sp));
+                break;
+            case OP_ADD:
+                sp--;
+                as.add(stackEntry(sp - 1), STACK_REGISTERS[sp]);
+                break;
+            case OP_SUB:
+                sp--;
+                as.sub(stackEntry(sp - 1), STACK_REGISTERS[sp]);
+                break;
+            case OP_MUL:
+                sp--;
+                as.imul(STACK_REGISTERS[sp - 1], stackEntry(sp));
+                break;
+            case OP_DIV: {
+                as.test(stackEntry(sp - 1), STACK_REGISTERS[sp - 1]);
+                exitTo(as.jumpIf(CC_EQ), pc, sp);
+                sp--;
+                as.cmpImmediate(stackEntry(sp), -1);
+                int divide = as.jumpIf(CC_NE);
+                as.neg(stackEntry(sp - 1));
+                int done = as.jump();
+                as.patch(divide, as.position() - (divide + 4));
+                as.move(reg(RAX), stackEntry(sp - 1));
+                as.cdq();
+                as.idiv(stackEntry(sp));
+                as.move(stackEntry(sp - 1), reg(RAX));
+                as.patch(done, as.position() - (done + 4));
+                break;
+            }
+            case OP_SHL:
+                as.shlImmediate(stackEntry(sp - 1), in.a);
+                break;
+            case OP_PRINT:
+                if (sp != 1) return false;
+                sp--;
+                as.move(reg(RSI), stackEntry(0));
+                as.loadPointer(RDI, mem(R15, offsetof(JitFrame, state)));
+                as.storeWide(mem(R15, offsetof(JitFrame, budget)), RCX);
+                as.call((const void *) &jitPrint);
+                as.loadPointer(RCX, mem(R15, offsetof(JitFrame, budget)));
+                break;
+            case OP_GOTO:
+                jumpTo(-1, in.c, pc, sp);
+                break;
+            case OP_IF_LT: case OP_IF_GT: case OP_IF_EQ: {
+                int condition = in.op == OP_IF_LT ? CC_LT : in.op == OP_IF_GT ? CC_GT : CC_EQ;
+                as.cmp(stackEntry(sp - 2), STACK_REGISTERS[sp - 1]);
+                jumpTo(condition, in.c, pc, sp);
+                sp -= 2;
+                break;
+            }
+            case OP_ADD_CONST:
+                as.move(reg(RAX), variable(in.b));
+                as.addImmediate(reg(RAX), in.c);
+                as.move(variable(in.a), reg(RAX));
+                break;
+            case OP_IF_CONST_LT: case OP_IF_CONST_GT: case OP_IF_CONST_EQ: {
+                int condition = in.op == OP_IF_CONST_LT ? CC_LT
+                              : in.op == OP_IF_CONST_GT ? CC_GT : CC_EQ;
+                as.cmpImmediate(variable(in.a), in.b);
+                jumpTo(condition, in.c, pc, sp);
+                break;
+            }
+            case OP_FAIL:
+                if (sp >= JIT_STACK_SLOTS) return false;
+                exitTo(as.jump(), pc, sp++);
+                break;
+            case OP_SYNTAX_ERROR:
+                exitTo(as.jump(), pc, sp--);
+                break;
+            default:
+                exitTo(as.jump(), pc, sp);
+                break;
+        }
+    }
+    exitTo(as.jump(), end, 0);
+    return true;
+}
+
+/*
+ * Implementation notes: emitExits
+ * -------------------------------
+ * Each stub saves the live stack entries into the frame, writes the
+ * register variables back, and returns the position to resume at.
+ */
+
+void RegionCompiler::emitExits() {
+    for (auto &entry : exits) {
+        int pc = entry.first.first;
+        int sp = entry.first.second;
+        for (int at : entry.second) as.patch(at, as.position() - (at + 4));
+        for (int i = 0; i < sp; i++) {
+            as.store(mem(R15, int(offsetof(JitFrame, stack) + 4 * i)), STACK_REGISTERS[i]);
+        }
+        for (auto &var : registers) as.move(mem(RBP, 8 * var.first), reg(var.second));
+        as.storeWide(mem(R15, offsetof(JitFrame, budget)), RCX);
+        as.moveImmediate(mem(R15, offsetof(JitFrame, sp)), sp);
+        as.moveImmediate(reg(RAX), pc);
+        int at = as.jump();
+        as.patch(at, epilogue - (at + 4));
+    }
+}
+
+bool RegionCompiler::compile(JitRegion &region) {
+    allocateRegisters(region);
+    static const Register SAVED[] = { RBX, RBP, R12, R13, R14, R15 };
+    for (Register r : SAVED) as.push(r);
+    as.byte(0x48); as.byte(0x83); as.byte(0xec); as.byte(0x08);   /* sub rsp, 8 */
+    as.rm({0x8b}, R15, reg(RDI), true);
+    as.loadPointer(RBP, mem(R15, offsetof(JitFrame, values)));
+    for (auto &var : registers) as.load(var.second, mem(RBP, 8 * var.first));
+    as.loadPointer(RCX, mem(R15, offsetof(JitFrame, budget)));
+    int entry = as.jump();
+    epilogue = as.position();
+    as.byte(0x48); as.byte(0x83); as.byte(0xc4); as.byte(0x08);   /* add rsp, 8 */
+    for (int i = 5; i >= 0; i--) as.pop(SAVED[i]);
+    as.byte(0xc3);
+    as.patch(entry, as.position() - (entry + 4));
+    if (!body()) return false;
+    for (const Fixup &fixup : fixups) {
+        as.patch(fixup.at, offsets[fixup.target] - (fixup.at + 4));
+    }
+    emitExits();
+    return true;
+}
+
+/*
+ * Implementation notes: compile
+ * -----------------------------
+ * The code is written into a private anonymous mapping that is only
+ * made executable after it has been made read-only.
+ */
+
+JitRegion *JitCode::compile(int start, int end) {
+    AllocScope scope(ALLOC_PROGRAM);
+    JitRegion *region = new JitRegion();
+    RegionCompiler compiler(code, start, end);
+    if (!compiler.compile(*region)) {
+        delete region;
+        return nullptr;
+    }
+    const std::vector<uint8_t> &bytes = compiler.bytes();
+    size_t page = 4096;
+    region->size = (bytes.size() + page - 1) / page * page;
+    void *memory = mmap(nullptr, region->size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        delete region;
+        return nullptr;
+    }
+    std::memcpy(memory, bytes.data(), bytes.size());
+    if (mprotect(memory, region->size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, region->size);
+        delete region;
+        return nullptr;
+    }
+    region->memory = memory;
+    region->function = (JitFunction) memory;
+    return region;
+}
+
+#else
+
+JitRegion *JitCode::compile(int start, int end) {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * File: jit.h
+ * -----------
+ * This interface exports JitCode, which translates hot loops of the
+ * threaded code into x86-64 machine code.
+ */
+
+#ifndef _jit_h
+#define _jit_h
+
+#include <vector>
+#include "threaded.hpp"
+#include "value.hpp"
+
+class EvalState;
+struct JitRegion;
+
+/*
+ * Class: JitCode
+ * --------------
+ * The native code compiled for one ThreadedCode.  The threaded engine
+ * reports every backward jump it takes; once a jump to the same target
+ * has been taken JIT_THRESHOLD times, the instructions from the target
+ * up to and including the jump are compiled into one native function.
+ *
+ * Inside the function the most used variables live in registers and
+ * the operand stack is mapped onto registers as well.  PRINT calls back
+ * into the interpreter's output; everything else that the native code
+ * does not handle (INPUT, END, statements without bytecode, errors, and
+ * jumps out of the region) leaves the function, writes the variables
+ * back and tells the engine where to continue, with the operand stack
+ * as it was at that instruction.  So a region never raises an error
+ * itself; the engine re-executes the instruction and reports it.
+ *
+ * Native code is only entered when every variable it uses is defined,
+ * which saves checking each load.  It belongs to the ThreadedCode it
+ * was compiled from, and is discarded with it when the program is
+ * edited.  On other platforms no code is ever compiled, and the JIT is
+ * not used at all with 64-bit values (useInt64), because the native
+ * code only implements the wrapping 32-bit arithmetic.
+ */
+
+class JitCode {
+
+public:
+
+/*
+ * Constructor: JitCode
+ * Usage: JitCode jit(code);
+ * -------------------------
+ * Creates an empty set of native regions for the threaded instructions
+ * in code, which must outlive this object.
+ */
+
+    explicit JitCode(const std::vector<ThreadedInstruction> &code);
+
+    ~JitCode();
+
+/*
+ * Method: enter
+ * Usage: int pc = jit.enter(target, source, state, stack, sp, budget, jump);
+ * --------------------------------------------------------------------------
+ * Called by the threaded engine when the jump at position source has
+ * gone backwards to target.  Counts the jump, compiles the loop once
+ * it is hot, and runs its native code if it exists and can be entered.
+ * Returns the position at which interpretation continues, with the
+ * operand stack stored in stack[0..sp), or -1 if the native code did
+ * not run.  budget is the number of backward jumps the native code may
+ * still take (see Program::backEdgeCountdown); every jump it takes is
+ * subtracted, and if budget reaches zero the code stops at the target
+ * of the last jump and sets jump to that jump's position.
+ */
+
+    int enter(int target, int source, EvalState &state, Value *stack, int &sp,
+              long long &budget, int &jump);
+
+/*
+ * Method: supported
+ * Usage: if (JitCode::supported()) . . .
+ * --------------------------------------
+ * Returns true if native code can be generated on this platform.
+ */
+
+    static bool supported();
+
+private:
+
+    JitCode(const JitCode &) = delete;
+    JitCode &operator=(const JitCode &) = delete;
+
+    JitRegion *compile(int start, int end);
+
+    const std::vector<ThreadedInstruction> &code;
+    std::vector<int> counts;                /* Back edges per target    */
+    std::vector<JitRegion *> regions;       /* Compiled, per target     */
+
+};
+
+/*
+ * Constant: JIT_THRESHOLD
+ * -----------------------
+ * The number of times a loop must go round before it is compiled.
+ */
+
+const int JIT_THRESHOLD = 100;
+
+/*
+ * Variable: useJit
+ * ----------------
+ * Enables native code for hot loops (true, the default).  Cleared by
+ * the --no-jit command-line option.
+ */
+
+extern bool useJit;
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * File: loader.cpp
+ * ----------------
+ * This file implements the loader.h interface.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "loader.hpp"
+#include "allocstats.hpp"
+#include "image.hpp"
+#include "statement.hpp"
+#include "Utils/error.hpp"
+#include "Utils/tokenScanner.hpp"
+
+/*
+ * Constant: PARALLEL_THRESHOLD
+ * ----------------------------
+ * The smallest program that is worth parsing on more than one thread
+ * when the caller leaves the choice to us.
+ */
+
+static const std::size_t PARALLEL_THRESHOLD = 4096;
+
+/*
+ * Type: LoadedLine
+ * ----------------
+ * One line of the file and the result of parsing it.  number is -1 for
+ * blank lines and for lines that do not start with a line number.
+ */
+
+struct LoadedLine {
+    std::string_view text;
+    int number = -1;
+    bool remove = false;             /* The line is a number on its own */
+    bool deferred = false;           /* Parse later on the main thread  */
+    Statement *stmt = nullptr;
+    int arena = -1;                  /* Index of the arena stmt is in   */
+    std::string message;             /* Error to report, if any         */
+};
+
+/*
+ * Implementation notes: describeFile
+ * ----------------------------------
+ * The path is made absolute so that an image still finds its source
+ * when it is loaded from another directory.
+ */
+
+static void describeStat(const struct stat &st, SourceFile &file) {
+    file.size = uint64_t(st.st_size);
+    file.modified = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static bool absolutePath(const std::string &filename, SourceFile &file) {
+    char resolved[PATH_MAX];
+    if (::realpath(filename.c_str(), resolved) == nullptr) return false;
+    file.path = resolved;
+    return true;
+}
+
+bool describeFile(const std::string &filename, SourceFile &file) {
+    struct stat st;
+    if (::stat(filename.c_str(), &st) < 0) return false;
+    describeStat(st, file);
+    return absolutePath(filename, file);
+}
+
+/*
+ * Implementation notes: readFile
+ * ------------------------------
+ * The file is read with as few system calls as possible: the buffer is
+ * sized from fstat, and one spare byte lets the first read that comes
+ * back short tell us we have reached the end.  The same fstat describes
+ * the file in file, so the description matches the text that was read.
+ */
+
+static std::string readFile(const std::string &filename, SourceFile &file) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) error("FILE NOT FOUND");
+    struct stat st;
+    std::size_t size = 0;
+    if (::fstat(fd, &st) == 0) {
+        if (st.st_size > 0) size = std::size_t(st.st_size);
+        describeStat(st, file);
+        absolutePath(filename, file);
+    }
+    std::string text(size + 1, '\0');
+    std::size_t used = 0;
+    while (true) {
+        if (used == text.size()) text.resize(2 * text.size());
+        ssize_t n = ::read(fd, &text[used], text.size() - used);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            error("CANNOT READ FILE");
+        }
+        if (n == 0) break;
+        used += std::size_t(n);
+    }
+    ::close(fd);
+    text.resize(used);
+    return text;
+}
+
+static std::vector<LoadedLine> splitLines(std::string_view text) {
+    std::vector<LoadedLine> lines;
+    lines.reserve(std::count(text.begin(), text.end(), '\n') + 1);
+    std::size_t start = 0;
+    while (start < text.size()) {
+        std::size_t end = text.find('\n', start);
+        if (end == std::string_view::npos) end = text.size();
+        std::size_t stop = end;
+        if (stop > start && text[stop - 1] == '\r') stop--;
+        lines.emplace_back();
+        lines.back().text = text.substr(start, stop - start);
+        start = end + 1;
+    }
+    return lines;
+}
+
+/*
+ * Implementation notes: parseLine
+ * -------------------------------
+ * Mirrors what processLine does with a numbered line, making the
+ * statement in arena, whose index in the program's arenas is index.
+ * Parsing an IF evaluates its target expression, which may assign to a
+ * variable, so when other threads are parsing at the same time (defer
+ * is true) IF lines are left for the main thread, which parses them in
+ * file order.  What a line that fails leaves in arena is freed with
+ * the arena.
+ */
+
+static void parseLine(LoadedLine &line, Arena &arena, int index, EvalState &state, bool defer) {
+    AllocScope scope(ALLOC_PARSER);
+    TokenScanner scanner;
+    scanner.ignoreWhitespace();
+    scanner.scanNumbers();
+    scanner.setInputView(line.text);
+    try {
+        std::string_view first = scanner.nextTokenView().text;
+        if (first.empty()) return;
+        if (!isNumeric(first)) error("SYNTAX ERROR");
+        line.number = std::stoi(std::string(first));
+        if (line.text == first) {
+            line.remove = true;
+            return;
+        }
+        Keyword keyword = lookupKeyword(scanner.nextTokenView().text);
+        if (defer && keyword == KW_IF) {
+            line.deferred = true;
+            return;
+        }
+        line.stmt = parseStatement(keyword, scanner, arena, state);
+        if (line.stmt != nullptr) line.arena = index;
+    } catch (ErrorException &ex) {
+        line.message = ex.getMessage();
+    } catch (std::exception &) {
+        line.message = "SYNTAX ERROR";
+    }
+}
+
+int chooseLoadThreads(int jobs, std::size_t lines) {
+    std::size_t batches = (lines + LOAD_BATCH_SIZE - 1) / LOAD_BATCH_SIZE;
+    std::size_t threads;
+    if (jobs > 0) {
+        threads = std::size_t(jobs);
+    } else if (lines < PARALLEL_THRESHOLD) {
+        threads = 1;
+    } else {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return int(std::max<std::size_t>(1, std::min(threads, batches)));
+}
+
+/*
+ * Implementation notes: loadProgramText
+ * -------------------------------------
+ * Threads claim batches of lines from a shared counter, and the lines
+ * of a batch share one arena, which the program takes over with them;
+ * IF lines parsed later on the main thread share one more.  Once every
+ * line is parsed, the records are sorted by line number; a stable sort
+ * keeps lines with the same number in file order, so the last one of
+ * each group is the one that typing the file in would have left.
+ */
+
+void loadProgramText(std::string_view text, Program &program, EvalState &state, int jobs) {
+    AllocScope scope(ALLOC_PROGRAM);
+    std::vector<LoadedLine> lines = splitLines(text);
+    std::size_t n = lines.size();
+    int threads = chooseLoadThreads(jobs, n);
+    bool defer = threads > 1;
+    std::size_t batches = (n + LOAD_BATCH_SIZE - 1) / LOAD_BATCH_SIZE;
+    std::vector<std::unique_ptr<Arena>> arenas(batches + 1);
+    std::atomic<std::size_t> next(0);
+    auto work = [&]() {
+        AllocScope workerScope(ALLOC_PROGRAM);
+        while (true) {
+            std::size_t begin = next.fetch_add(LOAD_BATCH_SIZE);
+            if (begin >= n) break;
+            std::size_t end = std::min(n, begin + LOAD_BATCH_SIZE);
+            std::size_t batch = begin / LOAD_BATCH_SIZE;
+            arenas[batch] = std::make_unique<Arena>();
+            for (std::size_t i = begin; i < end; i++) {
+                parseLine(lines[i], *arenas[batch], int(batch), state, defer);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) pool.emplace_back(work);
+    work();
+    for (std::thread &thread : pool) thread.join();
+
+    std::vector<std::size_t> order;
+    order.reserve(n);
+    for (std::size_t i = 0; i < n; i++) {
+        LoadedLine &line = lines[i];
+        if (line.deferred) {
+            line.deferred = false;
+            line.number = -1;
+            if (arenas[batches] == nullptr) arenas[batches] = std::make_unique<Arena>();
+            parseLine(line, *arenas[batches], int(batches), state, false);
+        }
+        if (!line.message.empty()) state.output() << line.message << '\n';
+        if (line.number >= 0) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return lines[a].number < lines[b].number;
+    });
+
+    std::vector<LineRecord> records;
+    records.reserve(order.size());
+    for (std::size_t k = 0; k < order.size(); k++) {
+        if (k + 1 < order.size() && lines[order[k + 1]].number == lines[order[k]].number) continue;
+        LoadedLine &line = lines[order[k]];
+        if (line.remove) continue;
+        records.push_back(LineRecord{line.number, line.arena, std::string(line.text), line.stmt});
+    }
+    program.setLines(std::move(records), std::move(arenas));
+}
+
+void loadProgram(const std::string &filename, Program &program, EvalState &state, int jobs) {
+    AllocScope scope(ALLOC_PROGRAM);
+    if (loadImage(filename, program, state, jobs)) return;
+    SourceFile file;
+    std::string text = readFile(filename, file);
+    loadProgramText(text, program, state, jobs);
+    program.setSourceFile(file);
+}
@@ -0,0 +1,81 @@
+/*
+ * File: loader.h
+ * --------------
+ * This interface exports functions that read a whole BASIC program
+ * from a file and install it in a Program in a single step, instead of
+ * feeding the lines to the interpreter one at a time.
+ */
+
+#ifndef _loader_h
+#define _loader_h
+
+#include <string>
+#include <string_view>
+#include "evalstate.hpp"
+#include "program.hpp"
+
+/*
+ * Function: loadProgram
+ * Usage: loadProgram(filename, program, state);
+ *        loadProgram(filename, program, state, jobs);
+ * ---------------------------------------------------
+ * Replaces program with the lines in the named file.  Each nonblank
+ * line must begin with a line number and means what it would mean if
+ * it were typed in: a number on its own deletes that line, a later
+ * line replaces an earlier one with the same number, and a line that
+ * does not parse is kept without a statement after its error message
+ * has been written to the output of state.  Lines without a number are
+ * reported as SYNTAX ERROR and skipped; nothing is executed.
+ *
+ * Numbered lines parse independently, so they are parsed on up to jobs
+ * threads.  If jobs is 0, the number of threads is chosen from the
+ * size of the program and the number of processors.  A file written by
+ * SAVE is an image and is loaded with loadImage instead, without
+ * parsing.  Raises an error if the file cannot be read.
+ */
+
+void loadProgram(const std::string &filename, Program &program, EvalState &state,
+                 int jobs = 0);
+
+/*
+ * Function: describeFile
+ * Usage: if (describeFile(filename, file)) . . .
+ * ----------------------------------------------
+ * Fills in file with the absolute path, size and modification time of
+ * the named file and returns true, or returns false if the file cannot
+ * be examined.  loadProgram records this in the program it loads, so
+ * that an image saved from it can tell whether the file has changed.
+ */
+
+bool describeFile(const std::string &filename, SourceFile &file);
+
+/*
+ * Function: loadProgramText
+ * Usage: loadProgramText(text, program, state, jobs);
+ * ---------------------------------------------------
+ * Works like loadProgram on source text that is already in memory.
+ */
+
+void loadProgramText(std::string_view text, Program &program, EvalState &state,
+                     int jobs = 0);
+
+/*
+ * Constant: LOAD_BATCH_SIZE
+ * -------------------------
+ * The number of lines a loading thread claims at a time.
+ */
+
+const std::size_t LOAD_BATCH_SIZE = 256;
+
+/*
+ * Function: chooseLoadThreads
+ * Usage: int threads = chooseLoadThreads(jobs, lines);
+ * ----------------------------------------------------
+ * Returns the number of threads to load a program of the given number
+ * of lines on, given the jobs argument of loadProgram.  Never more
+ * threads than there are batches of LOAD_BATCH_SIZE lines.
+ */
+
+int chooseLoadThreads(int jobs, std::size_t lines);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * File: optimizer.cpp
+ * -------------------
+ * This file implements the expression simplification pass.
+ */
+
+#include <climits>
+#include "optimizer.hpp"
+
+bool useOptimizer = true;
+
+static bool isConstant(Expression *exp) {
+    return exp->getType() == CONSTANT;
+}
+
+static bool isConstant(Expression *exp, Value value) {
+    return isConstant(exp) && ((ConstantExp *) exp)->getValue() == value;
+}
+
+/*
+ * Implementation notes: fold
+ * --------------------------
+ * Computes op on two constants the way the evaluator does.  Returns
+ * false for an operation that must be left to run time because it
+ * raises an error: DIVIDE BY ZERO, or INTEGER OVERFLOW in 64-bit mode.
+ */
+
+static bool fold(Operator op, Value left, Value right, Value &result) {
+    if (op == DIV_OP && right == 0) return false;
+    if (useInt64) {
+        switch (op) {
+            case ADD_OP: return !__builtin_add_overflow(left, right, &result);
+            case SUB_OP: return !__builtin_sub_overflow(left, right, &result);
+            case MUL_OP: return !__builtin_mul_overflow(left, right, &result);
+            case DIV_OP:
+                if (left == INT64_MIN && right == -1) return false;
+                result = left / right;
+                return true;
+            default:
+                return false;
+        }
+    }
+    switch (op) {
+        case ADD_OP: result = addValues(left, right); return true;
+        case SUB_OP: result = subValues(left, right); return true;
+        case MUL_OP: result = mulValues(left, right); return true;
+        case DIV_OP: result = divValues(left, right); return true;
+        default: return false;
+    }
+}
+
+/*
+ * Implementation notes: log2Exact
+ * -------------------------------
+ * Returns k if value is 2 to the k for some k from 1 to 30, and -1
+ * otherwise.  Multiplying by 1 is handled as an identity instead.
+ */
+
+static int log2Exact(Value value) {
+    if (value < 2 || value > (1 << 30) || (value & (value - 1)) != 0) return -1;
+    int k = 0;
+    while ((1 << k) != value) k++;
+    return k;
+}
+
+Expression *optimizeExp(Expression *exp, Arena &arena) {
+    if (!useOptimizer || exp->getType() != COMPOUND) return exp;
+    CompoundExp *cexp = (CompoundExp *) exp;
+    Operator op = cexp->getOperator();
+    Expression *lhs = cexp->getLHS();
+    Expression *rhs = cexp->getRHS();
+    if (op == ASSIGN_OP) {
+        Expression *value = optimizeExp(rhs, arena);
+        if (value == rhs) return exp;
+        return newCompoundExp(arena, op, lhs, value);
+    }
+    if (op != ADD_OP && op != SUB_OP && op != MUL_OP && op != DIV_OP) return exp;
+    Expression *left = optimizeExp(lhs, arena);
+    Expression *right = optimizeExp(rhs, arena);
+    if (isConstant(left) && isConstant(right)) {
+        Value result;
+        if (fold(op, ((ConstantExp *) left)->getValue(), ((ConstantExp *) right)->getValue(), result)) {
+            return arena.make<ConstantExp>(result);
+        }
+    }
+    switch (op) {
+        case ADD_OP:
+            if (isConstant(right, 0)) return left;
+            if (isConstant(left, 0)) return right;
+            break;
+        case SUB_OP:
+            if (isConstant(right, 0)) return left;
+            break;
+        case MUL_OP: {
+            if (isConstant(right, 1)) return left;
+            if (isConstant(left, 1)) return right;
+            int k = -1;
+            Expression *operand = left;
+            if (isConstant(right)) {
+                k = log2Exact(((ConstantExp *) right)->getValue());
+            } else if (isConstant(left)) {
+                k = log2Exact(((ConstantExp *) left)->getValue());
+                operand = right;
+            }
+            if (k > 0) return newCompoundExp(arena, SHL_OP, operand, arena.make<ConstantExp>(k));
+            break;
+        }
+        case DIV_OP:
+            if (isConstant(right, 1)) return left;
+            break;
+        default:
+            break;
+    }
+    if (left == lhs && right == rhs) return exp;
+    return newCompoundExp(arena, op, left, right);
+}
@@ -0,0 +1,45 @@
+/*
+ * File: optimizer.h
+ * -----------------
+ * This interface exports a simplification pass over expression trees,
+ * which is applied to every expression when its line is parsed.
+ */
+
+#ifndef _optimizer_h
+#define _optimizer_h
+
+#include "arena.hpp"
+#include "exp.hpp"
+
+/*
+ * Function: optimizeExp
+ * Usage: exp = optimizeExp(exp, arena);
+ * -------------------------------------
+ * Returns an expression that computes the same value as exp, produces
+ * the same errors at the same time, and has the same effect on
+ * variables, but usually has fewer nodes.  The pass
+ *
+ *  - folds operators whose operands are both constants,
+ *  - removes the identities x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1,
+ *  - replaces multiplication by a power of two with a shift.
+ *
+ * An operation that would fail is never folded, so DIVIDE BY ZERO and
+ * INTEGER OVERFLOW are still reported when, and only if, the line is
+ * executed.  Operands are
+ * never dropped unless they are constants, because evaluating a
+ * variable can fail.  New nodes are allocated in arena; exp itself is
+ * left unchanged and may share subtrees with the result.
+ */
+
+Expression *optimizeExp(Expression *exp, Arena &arena);
+
+/*
+ * Variable: useOptimizer
+ * ----------------------
+ * If false, optimizeExp returns its argument unchanged.  Set by the
+ * --no-optimize command-line option for debugging.
+ */
+
+extern bool useOptimizer;
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * File: output.cpp
+ * ----------------
+ * This file implements the Output class.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+#include "output.hpp"
+#include "allocstats.hpp"
+
+Output::Output(int fd) {
+    this->fd = fd;
+    buffered = !isatty(fd);
+    stalled = false;
+    threshold = DEFAULT_THRESHOLD;
+    buffer.reserve(threshold);
+}
+
+Output::~Output() {
+    flush();
+}
+
+void Output::setBuffered(bool flag) {
+    buffered = flag;
+    if (!buffered) flush();
+}
+
+bool Output::isBuffered() const {
+    return buffered;
+}
+
+void Output::setThreshold(std::size_t bytes) {
+    threshold = bytes;
+    if (buffer.size() >= threshold) flush();
+}
+
+/*
+ * Implementation notes: flush
+ * ---------------------------
+ * write may accept only part of the data or be interrupted by a
+ * signal, so the loop keeps going until everything is written or a
+ * real error occurs.  Output that cannot be written is dropped, just
+ * as std::cout drops it once the stream has failed.  A nonblocking
+ * descriptor that is full is not an error: what is left is kept for
+ * the next flush.
+ */
+
+void Output::flush() {
+    std::size_t written = 0;
+    stalled = false;
+    while (written < buffer.size()) {
+        ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                stalled = true;
+                buffer.erase(0, written);
+                return;
+            }
+            break;
+        }
+        written += std::size_t(n);
+    }
+    buffer.clear();
+}
+
+std::size_t Output::pending() const {
+    return buffer.size();
+}
+
+/*
+ * Implementation notes: append
+ * ----------------------------
+ * In unbuffered mode the sink still collects the pieces of a line and
+ * writes when the line is complete, so that PRINT costs one write
+ * rather than one per token.  While the descriptor is full, nothing is
+ * written until the owner calls flush, rather than trying again on
+ * every append.
+ */
+
+void Output::append(const char *data, std::size_t length) {
+    AllocScope scope(ALLOC_OUTPUT);
+    buffer.append(data, length);
+    if (stalled) return;
+    if (buffered) {
+        if (buffer.size() >= threshold) flush();
+    } else if (length > 0 && data[length - 1] == '\n') {
+        flush();
+    }
+}
+
+Output &Output::operator<<(const std::string &str) {
+    append(str.data(), str.size());
+    return *this;
+}
+
+Output &Output::operator<<(const char *str) {
+    std::size_t length = 0;
+    while (str[length] != '\0') length++;
+    append(str, length);
+    return *this;
+}
+
+Output &Output::operator<<(char ch) {
+    append(&ch, 1);
+    return *this;
+}
+
+Output &Output::operator<<(int value) {
+    char digits[16];
+    int length = std::snprintf(digits, sizeof digits, "%d", value);
+    append(digits, std::size_t(length));
+    return *this;
+}
+
+Output &Output::operator<<(int64_t value) {
+    char digits[24];
+    int length = std::snprintf(digits, sizeof digits, "%lld", (long long) value);
+    append(digits, std::size_t(length));
+    return *this;
+}
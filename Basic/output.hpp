@@ -0,0 +1,129 @@
+/*
+ * File: output.h
+ * --------------
+ * This interface exports the Output class, which collects everything
+ * the interpreter prints in a user-space buffer and hands it to the
+ * operating system in large writes.
+ */
+
+#ifndef _output_h
+#define _output_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Class: Output
+ * -------------
+ * An output sink attached to a file descriptor.  In buffered mode text
+ * is accumulated until the buffer reaches its threshold or flush is
+ * called; in unbuffered mode every completed line is written at once.
+ * All interpreter output, including error messages and INPUT prompts,
+ * goes through the same sink, so buffering never changes the order in
+ * which things appear.
+ */
+
+class Output {
+
+public:
+
+/*
+ * Constructor: Output
+ * Usage: Output out;
+ *        Output out(fd);
+ * ----------------------
+ * Creates a sink writing to fd (standard output by default).  The sink
+ * starts out unbuffered if fd refers to a terminal and buffered
+ * otherwise.
+ */
+
+    explicit Output(int fd = 1);
+
+/*
+ * Destructor: ~Output
+ * -------------------
+ * Flushes any pending output.
+ */
+
+    ~Output();
+
+/*
+ * Method: setBuffered
+ * Usage: out.setBuffered(flag);
+ * -----------------------------
+ * Switches between buffered and unbuffered mode.  Switching to
+ * unbuffered mode flushes the buffer.
+ */
+
+    void setBuffered(bool flag);
+
+    bool isBuffered() const;
+
+/*
+ * Method: setThreshold
+ * Usage: out.setThreshold(bytes);
+ * -------------------------------
+ * Sets the number of buffered bytes that triggers a write.
+ */
+
+    void setThreshold(std::size_t bytes);
+
+/*
+ * Method: flush
+ * Usage: out.flush();
+ * -------------------
+ * Writes all pending output to the file descriptor.  If the descriptor
+ * is nonblocking and cannot take all of it, the rest stays pending and
+ * the sink stops writing on its own until flush is called again.
+ */
+
+    void flush();
+
+/*
+ * Method: pending
+ * Usage: std::size_t n = out.pending();
+ * -------------------------------------
+ * Returns the number of bytes that have not been written yet.
+ */
+
+    std::size_t pending() const;
+
+/*
+ * Operator: <<
+ * Usage: out << value;
+ * --------------------
+ * Appends the text of value to the sink.
+ */
+
+    Output &operator<<(const std::string &str);
+
+    Output &operator<<(const char *str);
+
+    Output &operator<<(char ch);
+
+    Output &operator<<(int value);
+
+    Output &operator<<(int64_t value);
+
+/*
+ * Constant: DEFAULT_THRESHOLD
+ * ---------------------------
+ * The size at which a buffered sink writes if not flushed earlier.
+ */
+
+    static const std::size_t DEFAULT_THRESHOLD = 64 * 1024;
+
+private:
+
+    void append(const char *data, std::size_t length);
+
+    int fd;                    /* Destination file descriptor       */
+    bool buffered;             /* Hold output until threshold/flush */
+    bool stalled;              /* The last write would have blocked */
+    std::size_t threshold;     /* Size that triggers a write        */
+    std::string buffer;        /* Pending output                    */
+
+};
+
+#endif
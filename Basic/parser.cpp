@@ -4,7 +4,29 @@
  * Implements the parser.h interface.
  */
 
+#include <charconv>
 #include "parser.hpp"
+#include "allocstats.hpp"
+
+/*
+ * Implementation notes: tokenToInteger
+ * ------------------------------------
+ * Converts a NUMBER token to a value directly from the scanner's view of
+ * the line.  In 32-bit mode it accepts and rejects exactly what
+ * stringToInteger does for the tokens the scanner produces, and reports
+ * errors with the same message; in 64-bit mode any constant that fits
+ * in a Value is accepted.
+ */
+
+static Value tokenToInteger(std::string_view token) {
+    Value value = 0;
+    auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (result.ec != std::errc() || result.ptr != token.data() + token.size()
+        || (!useInt64 && !fitsInt(value))) {
+        error("stringToInteger: Illegal integer format (" + std::string(token) + ")");
+    }
+    return value;
+}
 
 
 /*
@@ -13,8 +35,9 @@
  * This code just reads an expression and then checks for extra tokens.
  */
 
-Expression *parseExp(TokenScanner &scanner) {
-    Expression *exp = readE(scanner);
+Expression *parseExp(TokenScanner &scanner, Arena &arena, Symbols &symbols) {
+    AllocScope scope(ALLOC_PARSER);
+    Expression *exp = readE(scanner, arena, symbols);
     if (scanner.hasMoreTokens()) {
         error("parseExp: Found extra token: " + scanner.nextToken());
     }
@@ -23,8 +46,8 @@ Expression *parseExp(TokenScanner &scanner) {
 
 /*
  * Implementation notes: readE
- * Usage: exp = readE(scanner, prec);
- * ----------------------------------
+ * Usage: exp = readE(scanner, arena, symbols, prec);
+ * --------------------------------------------------
  * This version of readE uses precedence to resolve the ambiguity in
  * the grammar.  At each recursive level, the parser reads operators and
  * subexpressions until it finds an operator whose precedence is greater
@@ -32,17 +55,16 @@ Expression *parseExp(TokenScanner &scanner) {
  * readE calls itself recursively to read in that subexpression as a unit.
  */
 
-Expression *readE(TokenScanner &scanner, int prec) {
-    Expression *exp = readT(scanner);
-    std::string token;
+Expression *readE(TokenScanner &scanner, Arena &arena, Symbols &symbols, int prec) {
+    Expression *exp = readT(scanner, arena, symbols);
     while (true) {
-        token = scanner.nextToken();
-        int newPrec = precedence(token);
+        Operator op = toOperator(scanner.peekToken().text);
+        int newPrec = precedence(op);
         if (newPrec <= prec) break;
-        Expression *rhs = readE(scanner, newPrec);
-        exp = new CompoundExp(token, exp, rhs);
+        scanner.nextTokenView();
+        Expression *rhs = readE(scanner, arena, symbols, newPrec);
+        exp = newCompoundExp(arena, op, exp, rhs);
     }
-    scanner.saveToken(token);
     return exp;
 }
 
@@ -53,15 +75,20 @@ Expression *readE(TokenScanner &scanner, int prec) {
  * or a parenthesized subexpression.
  */
 
-Expression *readT(TokenScanner &scanner) {
-    std::string token = scanner.nextToken();
-    TokenType type = scanner.getTokenType(token);
-    if (type == WORD) return new IdentifierExp(token);
-    if (type == NUMBER) return new ConstantExp(stringToInteger(token));
-    if (token == "-") return new CompoundExp(token, new ConstantExp(0), readE(scanner));
-    if (token != "(") error("Illegal term in expression");
-    Expression *exp = readE(scanner);
-    if (scanner.nextToken() != ")") {
+Expression *readT(TokenScanner &scanner, Arena &arena, Symbols &symbols) {
+    TokenScanner::Token token = scanner.nextTokenView();
+    if (token.type == WORD) {
+        std::string name(token.text);
+        return arena.make<IdentifierExp>(name, symbols.intern(name));
+    }
+    if (token.type == NUMBER) return arena.make<ConstantExp>(tokenToInteger(token.text));
+    if (token.text == "-") {
+        Expression *zero = arena.make<ConstantExp>(0);
+        return newCompoundExp(arena, SUB_OP, zero, readE(scanner, arena, symbols));
+    }
+    if (token.text != "(") error("Illegal term in expression");
+    Expression *exp = readE(scanner, arena, symbols);
+    if (scanner.nextTokenView().text != ")") {
         error("Unbalanced parentheses in expression");
     }
     return exp;
@@ -70,15 +97,21 @@ Expression *readT(TokenScanner &scanner) {
 /*
  * Implementation notes: precedence
  * --------------------------------
- * This function checks the token against each of the defined operators
- * and returns the appropriate precedence value.
+ * The string version resolves the token to an Operator and uses the
+ * Operator version, which is a simple table lookup.
  */
 
 int precedence(std::string token) {
-    if (token == "=") return 1;
-    if (token == "+" || token == "-") return 2;
-    if (token == "*" || token == "/") return 3;
-    return 0;
+    return precedence(toOperator(token));
+}
+
+int precedence(Operator op) {
+    switch (op) {
+        case ASSIGN_OP: return 1;
+        case ADD_OP: case SUB_OP: return 2;
+        case MUL_OP: case DIV_OP: return 3;
+        default: return 0;
+    }
 }
 
 // parseExp 函数读取一个表达式，并检查是否有额外的标记。如果有额外的标记，则抛出错误。
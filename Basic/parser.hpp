@@ -18,44 +18,49 @@
 
 /*
  * Function: parseExp
- * Usage: Expression *exp = parseExp(scanner);
- * -------------------------------------------
+ * Usage: Expression *exp = parseExp(scanner, arena, symbols);
+ * -----------------------------------------------------------
  * Parses an expression by reading tokens from the scanner, which must
  * be provided by the client.  The scanner should be set to ignore
- * whitespace and to scan numbers.
+ * whitespace and to scan numbers.  All nodes of the tree are allocated
+ * in arena, which owns them, and variable names are interned in
+ * symbols.
  */
 
-Expression *parseExp(TokenScanner &scanner);
+Expression *parseExp(TokenScanner &scanner, Arena &arena, Symbols &symbols);
 
 /*
  * Function: readE
- * Usage: Expression *exp = readE(scanner, prec);
- * ----------------------------------------------
+ * Usage: Expression *exp = readE(scanner, arena, symbols, prec);
+ * --------------------------------------------------------------
  * Returns the next expression from the scanner involving only operators
  * whose precedence is at least prec.  The prec argument is optional and
  * defaults to 0, which means that the function reads the entire expression.
  */
 
-Expression *readE(TokenScanner &scanner, int prec = 0);
+Expression *readE(TokenScanner &scanner, Arena &arena, Symbols &symbols, int prec = 0);
 
 /*
  * Function: readT
- * Usage: Expression *exp = readT(scanner);
- * ----------------------------------------
+ * Usage: Expression *exp = readT(scanner, arena, symbols);
+ * --------------------------------------------------------
  * Returns the next individual term, which is either a constant, an
  * identifier, or a parenthesized subexpression.
  */
 
-Expression *readT(TokenScanner &scanner);
+Expression *readT(TokenScanner &scanner, Arena &arena, Symbols &symbols);
 
 /*
  * Function: precedence
  * Usage: int prec = precedence(token);
+ *        int prec = precedence(op);
  * ------------------------------------
- * Returns the precedence of the specified operator token.  If the token
- * is not an operator, precedence returns 0.
+ * Returns the precedence of the specified operator token or Operator.
+ * If the token is not an operator, precedence returns 0.
  */
 
 int precedence(std::string token);
 
+int precedence(Operator op);
+
 #endif
@@ -0,0 +1,99 @@
+/*
+ * File: profiler.cpp
+ * ------------------
+ * This file implements the Profiler class.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "profiler.hpp"
+#include "program.hpp"
+
+Profiler::Profiler() {
+    report = false;
+}
+
+void Profiler::setReport(bool flag) {
+    report = flag;
+}
+
+void Profiler::setFoldedFile(const std::string &filename) {
+    foldedFile = filename;
+}
+
+void Profiler::start(const Program &program) {
+    lines.clear();
+    lines.reserve(program.size());
+    for (int i = 0; i < program.size(); i++) {
+        const LineRecord &rec = program.lineAt(i);
+        lines.push_back({rec.number, rec.source, 0, 0, Clock::duration::zero()});
+    }
+}
+
+void Profiler::finish() {
+    if (report) writeReport();
+    if (!foldedFile.empty()) writeFolded();
+}
+
+static long long toNanoseconds(Profiler::Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+/*
+ * Implementation notes: writeReport
+ * ---------------------------------
+ * Lines that never ran are left out.  Ties in time are broken by line
+ * number so that the report is stable.
+ */
+
+void Profiler::writeReport() const {
+    std::vector<const LineProfile *> ran;
+    long long total = 0, statements = 0;
+    for (const LineProfile &line : lines) {
+        if (line.count == 0) continue;
+        ran.push_back(&line);
+        total += toNanoseconds(line.time);
+        statements += line.count;
+    }
+    std::sort(ran.begin(), ran.end(), [](const LineProfile *a, const LineProfile *b) {
+        if (a->time != b->time) return a->time > b->time;
+        return a->number < b->number;
+    });
+    char buffer[96];
+    std::snprintf(buffer, sizeof buffer, "PROFILE: %lld statements, %lld ns\n",
+                  statements, total);
+    std::cerr << buffer;
+    std::cerr << "      LINE        COUNT        TAKEN         TIME(ns)  %TIME  SOURCE\n";
+    for (const LineProfile *line : ran) {
+        long long ns = toNanoseconds(line->time);
+        double percent = total > 0 ? 100.0 * double(ns) / double(total) : 0.0;
+        std::snprintf(buffer, sizeof buffer, "%10d %12lld %12lld %16lld %5.1f%%  ",
+                      line->number, line->count, line->taken, ns, percent);
+        std::cerr << buffer << line->source << '\n';
+    }
+    std::cerr.flush();
+}
+
+/*
+ * Implementation notes: writeFolded
+ * ---------------------------------
+ * BASIC has no subroutines, so every stack has two frames: the program
+ * and the line.  Semicolons separate frames in the folded format and
+ * are replaced in the source text.
+ */
+
+void Profiler::writeFolded() const {
+    std::ofstream out(foldedFile);
+    if (!out) {
+        std::cerr << "PROFILE: cannot write " << foldedFile << '\n';
+        return;
+    }
+    for (const LineProfile &line : lines) {
+        if (line.count == 0) continue;
+        std::string frame = line.source;
+        std::replace(frame.begin(), frame.end(), ';', ':');
+        out << "RUN;" << frame << ' ' << toNanoseconds(line.time) << '\n';
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * File: profiler.h
+ * ----------------
+ * This interface exports the Profiler class, which collects per-line
+ * statistics while a program runs and reports them when it stops.
+ */
+
+#ifndef _profiler_h
+#define _profiler_h
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+class Program;
+
+/*
+ * Class: Profiler
+ * ---------------
+ * For every line of the program the profiler counts how often the line
+ * was executed and how often it transferred control (a GOTO, or an IF
+ * whose condition was true), and accumulates the time spent in it.
+ * Program::run uses a separate loop when a profiler is attached, so
+ * programs run without one pay nothing for this.
+ */
+
+class Profiler {
+
+public:
+
+    typedef std::chrono::steady_clock Clock;
+
+    Profiler();
+
+/*
+ * Method: setReport
+ * Usage: profiler.setReport(true);
+ * --------------------------------
+ * Requests a report on standard error, with the lines sorted by the
+ * time spent in them, each time a program stops.
+ */
+
+    void setReport(bool flag);
+
+/*
+ * Method: setFoldedFile
+ * Usage: profiler.setFoldedFile(filename);
+ * ----------------------------------------
+ * Requests that the profile be written to filename in the folded-stack
+ * format read by flame graph tools each time a program stops.  The
+ * weight of each line is the time spent in it, in nanoseconds.
+ */
+
+    void setFoldedFile(const std::string &filename);
+
+/*
+ * Method: start
+ * Usage: profiler.start(program);
+ * -------------------------------
+ * Discards the previous profile and prepares to profile a run of
+ * program.  The line numbers and source text are copied, so the
+ * profile survives a program that clears itself.
+ */
+
+    void start(const Program &program);
+
+/*
+ * Method: record
+ * Usage: profiler.record(index, taken, elapsed);
+ * ----------------------------------------------
+ * Records one execution of the line at position index in the line
+ * table that took elapsed time and jumped if taken is true.
+ */
+
+    void record(int index, bool taken, Clock::duration elapsed) {
+        LineProfile &line = lines[index];
+        line.count++;
+        if (taken) line.taken++;
+        line.time += elapsed;
+    }
+
+/*
+ * Method: finish
+ * Usage: profiler.finish();
+ * -------------------------
+ * Writes the report and the folded-stack file that were requested.
+ */
+
+    void finish();
+
+private:
+
+    struct LineProfile {
+        int number;
+        std::string source;
+        long long count;
+        long long taken;
+        Clock::duration time;
+    };
+
+    void writeReport() const;
+    void writeFolded() const;
+
+    std::vector<LineProfile> lines;   /* Indexed like the line table  */
+    bool report;                      /* Write report to stderr       */
+    std::string foldedFile;           /* Folded stacks, if non-empty  */
+
+};
+
+#endif
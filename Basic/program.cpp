@@ -9,8 +9,11 @@
  */
 
 #include "program.hpp"
+#include "allocstats.hpp"
+#include "Utils/error.hpp"
 #include "evalstate.hpp"
 #include "statement.hpp"
+#include <algorithm>
 #include <string>
 
 
@@ -21,84 +24,355 @@ Program::~Program(){
     clear();
 }
 void Program::clear() {
-    // std::cout<<exist_line.size()<<'\n';
-    original_line.clear();
-    if(exist_line.size()==0) return;
-    for(auto it=exist_line.begin();it!=exist_line.end();++it){
-        // std::cout<<*it<<'\n';
-        delete processed_line[*it];
+    AllocScope scope(ALLOC_PROGRAM);
+    lines.clear();
+    arenas.clear();
+    editArena=-1;
+    linked=false;
+    source=SourceFile();
+}
+
+/*
+ * Implementation notes: line arenas
+ * ---------------------------------
+ * Statements are made in arenas that many lines share: one for each
+ * batch of a loaded file, and one that lines entered singly go into
+ * until it is full (see EDIT_ARENA_LIMIT).  Each arena counts the lines whose
+ * statement it holds and is freed when the last of them is replaced or
+ * removed, so the space of an edited line comes back once the other
+ * lines of its arena have gone too.  The arena that is taking edits is
+ * kept until it is full even when it holds no line.
+ */
+
+void Program::release(LineRecord &rec) {
+    if(rec.arena>=0){
+        LineArena &owner=arenas[rec.arena];
+        if(--owner.lines==0 && rec.arena!=editArena) owner.arena.reset();
+    }
+    rec.arena=-1;
+    rec.stmt=nullptr;
+}
+
+Arena &Program::lineArena() {
+    AllocScope scope(ALLOC_PROGRAM);
+    if(editArena>=0 && arenas[editArena].arena->bytesUsed()>=EDIT_ARENA_LIMIT
+       && arenas[editArena].arena->bytesFree()<EDIT_ARENA_SLACK){
+        if(arenas[editArena].lines==0) arenas[editArena].arena.reset();
+        editArena=-1;
+    }
+    if(editArena<0){
+        // 优先复用已经释放的位置，行记录中的下标因此保持不变
+        editArena=0;
+        while(editArena<int(arenas.size()) && arenas[editArena].arena!=nullptr) editArena++;
+        if(editArena==int(arenas.size())) arenas.emplace_back();
+        arenas[editArena].arena=std::make_unique<Arena>();
+        arenas[editArena].lines=0;
     }
-    processed_line.clear();
-    exist_line.clear();
+    return *arenas[editArena].arena;
 }
+
+/*
+ * Implementation notes: lowerBound
+ * --------------------------------
+ * Returns the index of the first line whose number is not less than
+ * lineNumber, which is where a line with that number is or would be
+ * inserted.
+ */
+
+int Program::lowerBound(int lineNumber) const {
+    auto it=std::lower_bound(lines.begin(),lines.end(),lineNumber,
+                             [](const LineRecord &rec,int n){return rec.number<n;});
+    return int(it-lines.begin());
+}
+
 void Program::addSourceLine(int lineNumber, const std::string &line) {
-    if(exist_line.find(lineNumber)!=exist_line.end()) {
-        original_line.erase(lineNumber);
-        delete processed_line[lineNumber];
-        processed_line[lineNumber] = nullptr;
+    AllocScope scope(ALLOC_PROGRAM);
+    linked=false;
+    source=SourceFile();
+    int index=lowerBound(lineNumber);
+    if(index<int(lines.size()) && lines[index].number==lineNumber){
+        lines[index].source=line;
+        release(lines[index]);
+        return;
     }
-    original_line.insert(std::make_pair(lineNumber, line));
-    exist_line.insert(lineNumber);
-    // processed_line 在Basic文件中实现
+    lines.insert(lines.begin()+index,LineRecord{lineNumber,-1,line,nullptr});
+    // 解析后的 statement 在Basic文件中设置
 }
 
 void Program::removeSourceLine(int lineNumber) {
-    if(exist_line.find(lineNumber)==exist_line.end()) return;
-    original_line.erase(lineNumber);
-    delete processed_line[lineNumber];
-    processed_line.erase(lineNumber);
-    exist_line.erase(lineNumber);
+    AllocScope scope(ALLOC_PROGRAM);
+    int index=indexOf(lineNumber);
+    if(index<0) return;
+    linked=false;
+    source=SourceFile();
+    release(lines[index]);
+    lines.erase(lines.begin()+index);
 }
 
 std::string Program::getSourceLine(int lineNumber) {
-    if(exist_line.find(lineNumber)==exist_line.end())  return "";
-    return original_line[lineNumber];
+    int index=indexOf(lineNumber);
+    if(index<0) return "";
+    return lines[index].source;
 }
-// hhuihuihui
+
 void Program::setParsedStatement(int lineNumber, Statement *stmt) {
-    // auto it2=processed_line.find(lineNumber);
-    // if(it2!=processed_line.end()){
-    //     if(it2!=nullptr){
-    //         delete it2;
-    //     }
-    //     it2->second=stmt;
-    //     return;
-    // }
-    if(processed_line.count(lineNumber)){
-        // if(processed_line[lineNumber]!=NULL)std::cout<<"??";
-        // exit(0);
-        // processed_line[lineNumber]->execute(, Program &program)
-        delete  processed_line[lineNumber];
-        processed_line[lineNumber]=stmt;
+    AllocScope scope(ALLOC_PROGRAM);
+    linked=false;
+    source=SourceFile();
+    int index=lowerBound(lineNumber);
+    if(index>=int(lines.size()) || lines[index].number!=lineNumber){
+        lines.insert(lines.begin()+index,LineRecord{lineNumber,-1,"",nullptr});
     }
-        // processed_line.erase(lineNumber);
-        //processed_line.insert(std::make_pair(lineNumber,stmt));
-        
-    else {
-        exist_line.insert(lineNumber);
-        processed_line[lineNumber]=stmt;
+    release(lines[index]);
+    if(stmt==nullptr) return;
+    lines[index].stmt=stmt;
+    lines[index].arena=editArena;
+    arenas[editArena].lines++;
+}
+
+void Program::setLines(std::vector<LineRecord> records, std::vector<std::unique_ptr<Arena>> owned) {
+    AllocScope scope(ALLOC_PROGRAM);
+    linked=false;
+    source=SourceFile();
+    lines=std::move(records);
+    arenas.clear();
+    editArena=-1;
+    for(std::unique_ptr<Arena> &arena : owned) arenas.push_back(LineArena{std::move(arena),0});
+    for(const LineRecord &rec : lines){
+        if(rec.arena>=0) arenas[rec.arena].lines++;
     }
+    // 没有留下任何语句的 arena（例如整批都解析失败）直接释放
+    for(LineArena &owner : arenas){
+        if(owner.lines==0) owner.arena.reset();
+    }
+}
+
+void Program::setSourceFile(const SourceFile &file) {
+    source=file;
+}
+
+const SourceFile &Program::sourceFile() const {
+    return source;
 }
 
 Statement *Program::getParsedStatement(int lineNumber) {
-    if(processed_line.find(lineNumber)==processed_line.end()) return nullptr;
-    return processed_line[lineNumber];
+    int index=indexOf(lineNumber);
+    if(index<0) return nullptr;
+    return lines[index].stmt;
 }
 
 int Program::getFirstLineNumber() {
-    if(exist_line.empty()) return -1;
-    return *exist_line.begin();
+    if(lines.empty()) return -1;
+    return lines.front().number;
 }
 
 int Program::getNextLineNumber(int lineNumber) {
-    if(lineNumber==*exist_line.rbegin()) return -1;
-    else return *exist_line.upper_bound(lineNumber);
+    int index=lowerBound(lineNumber);
+    if(index<int(lines.size()) && lines[index].number==lineNumber) index++;
+    if(index>=int(lines.size())) return -1;
+    return lines[index].number;
+}
+
+bool Program::hasLine(int lineNumber) const {
+    return indexOf(lineNumber)>=0;
+}
+
+int Program::indexOf(int lineNumber) const {
+    int index=lowerBound(lineNumber);
+    if(index<int(lines.size()) && lines[index].number==lineNumber) return index;
+    return -1;
+}
+
+int Program::size() const {
+    return int(lines.size());
+}
+
+const LineRecord &Program::lineAt(int index) const {
+    return lines[index];
+}
+
+void Program::link() {
+    AllocScope scope(ALLOC_PROGRAM);
+    for(auto &rec:lines){
+        if(rec.stmt!=nullptr) rec.stmt->link(*this);
+    }
+    threaded.reset();
+    linked=true;
+}
+
+bool Program::isLinked() const {
+    return linked;
+}
+
+/*
+ * Implementation notes: run, resume, execute
+ * ------------------------------------------
+ * The loop walks the line table by index.  Branch targets were
+ * resolved to indices by link, so neither falling through nor jumping
+ * searches the table.  Lines whose statement failed to parse have no
+ * statement and are skipped.  A run starts at index 0 and a resumed
+ * one at the line it was suspended at; a program that has been edited
+ * since is no longer linked, so it cannot be resumed.  An INPUT that
+ * finds no line stops the run like END, and the program is suspended
+ * at the INPUT's line so that resuming reads the line again.
+ */
+
+void Program::run(EvalState &state) {
+    resumeIndex=-1;
+    state.cancelInput();
+    execute(state,0);
+}
+
+void Program::resume(EvalState &state) {
+    if(!isSuspended()) error("CAN'T CONTINUE");
+    int index=resumeIndex;
+    resumeIndex=-1;
+    execute(state,index);
+}
+
+bool Program::isSuspended() const {
+    return resumeIndex>=0 && linked;
 }
 
-//more func to add
-//todo
+int Program::suspendedLine() const {
+    return isSuspended()?lines[resumeIndex].number:-1;
+}
 
+void Program::execute(EvalState &state, int index) {
+    AllocScope scope(ALLOC_EVAL);
+    if(!linked) link();
+    startSlice();
+    if(profiler!=nullptr){
+        runProfiled(state,index);
+        return;
+    }
+    if(useBytecode && useThreaded){
+        if(!threaded){
+            AllocScope compileScope(ALLOC_PROGRAM);
+            threaded.reset(new ThreadedCode(*this));
+        }
+        jump_index=-1;
+        whether_stop=false;
+        threaded->run(state,*this,index);
+        return;
+    }
+    jump_index=-1;
+    while(index<int(lines.size())){
+        Statement *stmt=lines[index].stmt;
+        if(stmt!=nullptr) stmt->execute(state,*this);
+        if(whether_stop){
+            //错误：要重置 whether_stop
+            whether_stop=false;
+            // INPUT 没有可读的行时也会停下：挂起在这一行，恢复时重新执行 INPUT
+            if(state.waitingForInput()) suspend(index);
+            break;
+        }
+        if(jump_index>=0){
+            bool backward=jump_index<=index;
+            index=jump_index;
+            jump_index=-1;
+            if(backward && backEdge()){
+                suspend(index);
+                return;
+            }
+            //错误：continue不能漏
+            continue;
+        }
+        index++;
+    }
+}
+
+void Program::setProfiler(Profiler *profiler) {
+    this->profiler=profiler;
+}
 
+/*
+ * Implementation notes: runProfiled
+ * ---------------------------------
+ * The same loop as execute, with every statement timed and recorded.
+ * A statement that raises an error is recorded as well, and the
+ * profile is reported before the error propagates.  Program output is
+ * flushed first so that the report follows it on a terminal.
+ */
+
+void Program::runProfiled(EvalState &state, int index) {
+    profiler->start(*this);
+    jump_index=-1;
+    Profiler::Clock::time_point start;
+    try{
+        while(index<int(lines.size())){
+            Statement *stmt=lines[index].stmt;
+            start=Profiler::Clock::now();
+            if(stmt!=nullptr) stmt->execute(state,*this);
+            profiler->record(index,jump_index>=0,Profiler::Clock::now()-start);
+            if(whether_stop){
+                whether_stop=false;
+                if(state.waitingForInput()) suspend(index);
+                break;
+            }
+            if(jump_index>=0){
+                bool backward=jump_index<=index;
+                index=jump_index;
+                jump_index=-1;
+                if(backward && backEdge()){
+                    suspend(index);
+                    break;
+                }
+                continue;
+            }
+            index++;
+        }
+    }catch(...){
+        profiler->record(index,false,Profiler::Clock::now()-start);
+        state.output().flush();
+        profiler->finish();
+        throw;
+    }
+    state.output().flush();
+    profiler->finish();
+}
+
+/*
+ * Implementation notes: budgets
+ * -----------------------------
+ * The budget of a slice is handed out in stretches: countdown holds
+ * the backward jumps left in the current stretch and stepsLeft those
+ * not yet handed out.  Without a time budget one stretch covers the
+ * whole step budget; with one, stretches are BUDGET_CHECK_INTERVAL
+ * jumps long and the clock is read at the end of each.  Without any
+ * budget countdown starts at LLONG_MAX and never reaches zero, so the
+ * engines pay one decrement per backward jump.
+ */
+
+void Program::setBudget(long long steps, std::chrono::nanoseconds time) {
+    stepBudget=steps;
+    timeBudget=time;
+}
+
+void Program::startSlice() {
+    stepsLeft=stepBudget>0?stepBudget:LLONG_MAX;
+    if(timeBudget.count()>0) deadline=Clock::now()+timeBudget;
+    refill();
+}
+
+void Program::refill() {
+    long long stretch=stepsLeft;
+    if(timeBudget.count()>0 && stretch>BUDGET_CHECK_INTERVAL) stretch=BUDGET_CHECK_INTERVAL;
+    countdown=stretch;
+    stepsLeft-=stretch;
+}
+
+bool Program::sliceExpired() {
+    if(countdown>0) return false;
+    if(stepsLeft<=0) return true;
+    if(timeBudget.count()>0 && Clock::now()>=deadline) return true;
+    refill();
+    return false;
+}
+
+void Program::suspend(int index) {
+    resumeIndex=index;
+}
 
 // program用来存每一行的信息以及对每一行的操作
 
@@ -8,15 +8,51 @@
 #ifndef _program_h
 #define _program_h
 
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
-#include <set>
-#include <unordered_map>
-#include<bits/stdc++.h>
+#include "arena.hpp"
+#include "threaded.hpp"
+#include "profiler.hpp"
 #include "statement.hpp"
 
 
 class Statement;
+class EvalState;
+
+/*
+ * Type: LineRecord
+ * ----------------
+ * One line of a stored program: its number, the index of the program's
+ * line arena that holds the statement and its expression trees (-1 if
+ * there is no statement), the source text exactly as entered, and the
+ * parsed statement (NULL until one has been set).
+ */
+
+struct LineRecord {
+    int number;
+    int arena;
+    std::string source;
+    Statement *stmt;
+};
+
+/*
+ * Type: SourceFile
+ * ----------------
+ * The file a program was loaded from, as it was when it was read: its
+ * absolute path, its size in bytes and the time it was last modified,
+ * in nanoseconds.  path is empty if the program did not come from a
+ * file or has been edited since.
+ */
+
+struct SourceFile {
+    std::string path;
+    uint64_t size = 0;
+    int64_t modified = 0;
+};
 
 /*
  * This class stores the lines in a BASIC program.  Each line
@@ -29,6 +65,10 @@ class Statement;
  *
  * 2. The parsed representation of that statement, which is a
  *    pointer to a Statement.
+ *
+ * The lines are kept in a single array of LineRecords sorted by line
+ * number.  Lookups use binary search, and the interpreter advances
+ * from one line to the next by moving to the adjacent array index.
  */
 
 class Program {
@@ -97,18 +137,55 @@ public:
 
     std::string getSourceLine(int lineNumber);
 
+/*
+ * Method: lineArena
+ * Usage: Arena &arena = program.lineArena();
+ * ------------------------------------------
+ * Returns the arena in which the statement passed to the next call of
+ * setParsedStatement must be made.  Lines entered one at a time share
+ * their arenas, so each line costs only the space its statement uses.
+ */
+
+    Arena &lineArena();
+
 /*
  * Method: setParsedStatement
  * Usage: program.setParsedStatement(lineNumber, stmt);
  * ----------------------------------------------------
  * Adds the parsed representation of the statement to the statement
- * at the specified line number.  If no such line exists, this
- * method raises an error.  If a previous parsed representation
- * exists, the memory for that statement is reclaimed.
+ * at the specified line number.  stmt and its expressions must have
+ * been made in lineArena().  If a previous parsed representation
+ * exists, it is released.
  */
 
     void setParsedStatement(int lineNumber, Statement *stmt);
 
+/*
+ * Method: setLines
+ * Usage: program.setLines(std::move(records), std::move(arenas));
+ * ---------------------------------------------------------------
+ * Replaces the whole program with records, which must be sorted by
+ * line number with no number appearing twice.  The arena field of each
+ * record is an index into arenas, which the program takes over.  This
+ * is how a loaded file is installed without inserting the lines one at
+ * a time.
+ */
+
+    void setLines(std::vector<LineRecord> records, std::vector<std::unique_ptr<Arena>> arenas);
+
+/*
+ * Methods: setSourceFile, sourceFile
+ * Usage: program.setSourceFile(file);
+ * -----------------------------------
+ * Record and return the file the program was loaded from.  Any change
+ * to the lines, including setLines, forgets the file again, so a
+ * loader sets it once the lines are in place.
+ */
+
+    void setSourceFile(const SourceFile &file);
+
+    const SourceFile &sourceFile() const;
+
 /*
  * Method: getParsedStatement
  * Usage: Statement *stmt = program.getParsedStatement(lineNumber);
@@ -141,18 +218,221 @@ public:
 
     int getNextLineNumber(int lineNumber);
 
-    //more func to add
-    //todo
+/*
+ * Method: hasLine
+ * Usage: if (program.hasLine(lineNumber)) . . .
+ * ---------------------------------------------
+ * Returns true if the program contains a line with this number.
+ */
+
+    bool hasLine(int lineNumber) const;
+
+/*
+ * Method: indexOf
+ * Usage: int index = program.indexOf(lineNumber);
+ * -----------------------------------------------
+ * Returns the position of the specified line in the line table, or -1
+ * if there is no such line.
+ */
+
+    int indexOf(int lineNumber) const;
+
+/*
+ * Methods: size, lineAt
+ * Usage: for (int i = 0; i < program.size(); i++) {
+ *           const LineRecord &rec = program.lineAt(i);
+ *        }
+ * -------------------------------------------------
+ * Give direct access to the line table in line-number order.
+ */
 
-    //判断是不是一个合法的指令
-    bool judge(std::string str);
-    
-    std::unordered_map<int,std::string> original_line;//存储string形态的每一行的代码
-    std::unordered_map<int,Statement*> processed_line;
-    std::set<int> exist_line;//存储已经存在的行数
-    int current_line=0;
+    int size() const;
+
+    const LineRecord &lineAt(int index) const;
+
+/*
+ * Method: link
+ * Usage: program.link();
+ * ----------------------
+ * Resolves the branch targets of every statement to positions in the
+ * line table.  Adding or removing a line shifts those positions, so
+ * every edit marks the program as unlinked and run relinks it before
+ * the next execution; a program that is run repeatedly without being
+ * edited is linked only once.
+ */
+
+    void link();
+
+/*
+ * Method: isLinked
+ * Usage: if (program.isLinked()) . . .
+ * ------------------------------------
+ * Returns true if the program has not been edited since it was last
+ * linked.
+ */
+
+    bool isLinked() const;
+
+/*
+ * Method: run
+ * Usage: program.run(state);
+ * --------------------------
+ * Executes the program from its first line until it runs off the end
+ * or executes END.  Statements request a jump by setting jump_index to
+ * the position of the target line and request termination by setting
+ * whether_stop; QUIT also sets quit_requested, which the session that
+ * ran the program reads and clears.  Unless the tree interpreter or the statement loop has
+ * been selected, the program is compiled into ThreadedCode, which is
+ * kept until the program is edited.  If a profiler is attached, the
+ * run goes through the statement loop so that it can be profiled, and
+ * the profiler reports when the program stops, including when it stops
+ * because of an error.  A suspended run is discarded.  If INPUT reads
+ * from a queue (see EvalState::useInputQueue) and the queue is empty,
+ * the program is suspended at the INPUT, which runs again when the
+ * program is resumed.
+ */
+
+    void run(EvalState &state);
+
+/*
+ * Method: setBudget
+ * Usage: program.setBudget(steps, time);
+ * --------------------------------------
+ * Limits every slice of execution (one call to run or resume) to steps
+ * backward jumps and to time of wall-clock time; zero means no limit.
+ * Only backward jumps can keep a program running for long, so they are
+ * the steps that are counted, and the clock is read only every
+ * BUDGET_CHECK_INTERVAL of them.  When a slice runs out of budget the
+ * program is suspended at the target of the jump that used it up, with
+ * every variable intact, and run returns to its caller.
+ */
+
+    void setBudget(long long steps, std::chrono::nanoseconds time);
+
+/*
+ * Method: isSuspended
+ * Usage: if (program.isSuspended()) . . .
+ * ---------------------------------------
+ * Returns true if the last slice ran out of budget or stopped at an
+ * INPUT with nothing to read, and the program has not been edited
+ * since, so that it can be resumed.
+ */
+
+    bool isSuspended() const;
+
+/*
+ * Method: suspendedLine
+ * Usage: int lineNumber = program.suspendedLine();
+ * ------------------------------------------------
+ * Returns the number of the line a suspended program resumes at.
+ */
+
+    int suspendedLine() const;
+
+/*
+ * Method: resume
+ * Usage: program.resume(state);
+ * -----------------------------
+ * Runs another slice of a suspended program from where it stopped.
+ * Reports CAN'T CONTINUE if the program is not suspended.
+ */
+
+    void resume(EvalState &state);
+
+/*
+ * Methods: backEdge, backEdgeCountdown, sliceExpired
+ * --------------------------------------------------
+ * Used by the engines to enforce the budget.  backEdge counts one
+ * backward jump and returns true if the program must be suspended.
+ * Native code counts down backEdgeCountdown itself and calls
+ * sliceExpired when it reaches zero, which either starts the next
+ * stretch of the budget or returns true.  The engine then calls
+ * suspend with the index of the line to resume at.
+ */
+
+    bool backEdge() {
+        return --countdown == 0 && sliceExpired();
+    }
+
+    long long &backEdgeCountdown() {
+        return countdown;
+    }
+
+    bool sliceExpired();
+
+    void suspend(int index);
+
+/*
+ * Method: setProfiler
+ * Usage: program.setProfiler(&profiler);
+ * --------------------------------------
+ * Attaches a profiler to every later run, or detaches it if profiler
+ * is NULL.
+ */
+
+    void setProfiler(Profiler *profiler);
+
+    int jump_index=-1;
     bool whether_stop=false;
-    
+    bool quit_requested=false;
+
+/*
+ * Constant: BUDGET_CHECK_INTERVAL
+ * -------------------------------
+ * The number of backward jumps between two readings of the clock when
+ * a time budget is set.
+ */
+
+    static const long long BUDGET_CHECK_INTERVAL = 1024;
+
+/*
+ * Constants: EDIT_ARENA_LIMIT, EDIT_ARENA_SLACK
+ * ---------------------------------------------
+ * The arena that takes lines entered one at a time is retired once it
+ * holds EDIT_ARENA_LIMIT bytes and fewer than EDIT_ARENA_SLACK are
+ * left in its current block, so that it ends nearly full.
+ */
+
+    static const std::size_t EDIT_ARENA_LIMIT = 16384;
+    static const std::size_t EDIT_ARENA_SLACK = 1024;
+
+private:
+
+/*
+ * Type: LineArena
+ * ---------------
+ * An arena that holds the statements of some of the lines, with the
+ * number of lines whose statement is still in it.
+ */
+
+    struct LineArena {
+        std::unique_ptr<Arena> arena;
+        int lines;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    int lowerBound(int lineNumber) const;
+    void execute(EvalState &state, int index);
+    void runProfiled(EvalState &state, int index);
+    void startSlice();
+    void refill();
+    void release(LineRecord &rec);
+
+    std::vector<LineRecord> lines;    /* Sorted by line number        */
+    std::vector<LineArena> arenas;    /* Hold the lines' statements   */
+    int editArena=-1;                 /* Takes lines entered singly   */
+    SourceFile source;                /* Where the lines were read    */
+    bool linked=false;                /* Targets match the line table */
+    Profiler *profiler=nullptr;       /* Attached profiler, if any    */
+    std::unique_ptr<ThreadedCode> threaded;  /* Built by the first run */
+    long long stepBudget=0;           /* Backward jumps per slice     */
+    std::chrono::nanoseconds timeBudget{0};  /* Time per slice        */
+    long long stepsLeft=0;            /* Not yet in countdown         */
+    long long countdown=LLONG_MAX;    /* Jumps before the next check  */
+    Clock::time_point deadline;       /* End of the current slice     */
+    int resumeIndex=-1;               /* Where a suspended run goes on */
+
 };
 
 #endif
@@ -0,0 +1,341 @@
+/*
+ * File: server.cpp
+ * ----------------
+ * This file implements the server.h interface.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.hpp"
+#include "session.hpp"
+
+/*
+ * Class: SocketInput
+ * ------------------
+ * A stream buffer over the bytes a client has sent.  receive adds what
+ * has already arrived without waiting, and nothing ever waits for
+ * more: INPUT takes its lines from the session's queue, and the event
+ * loop brings the connection back when another line arrives.
+ */
+
+class SocketInput : public std::streambuf {
+
+public:
+
+    explicit SocketInput(int fd) : fd(fd), closed(false) {
+    }
+
+/*
+ * Method: receive
+ * Usage: input.receive();
+ * -----------------------
+ * Appends the data that is waiting on the socket, up to a limit, so
+ * that a client that never stops sending cannot hold a worker.
+ */
+
+    void receive() {
+        for (int i = 0; i < RECEIVE_LIMIT && fill(); i++) {
+            /* Empty */
+        }
+    }
+
+/*
+ * Method: hasLine
+ * Usage: if (input.hasLine()) . . .
+ * ---------------------------------
+ * Returns true if a complete line has arrived, or the client has
+ * closed the connection after sending the start of one.
+ */
+
+    bool hasLine() {
+        if (gptr() == egptr()) return false;
+        return closed || std::memchr(gptr(), '\n', std::size_t(egptr() - gptr())) != nullptr;
+    }
+
+/*
+ * Method: atEnd
+ * Usage: if (input.atEnd()) . . .
+ * -------------------------------
+ * Returns true once the connection is closed and everything it sent
+ * has been read.
+ */
+
+    bool atEnd() {
+        return closed && gptr() == egptr();
+    }
+
+protected:
+
+    int_type underflow() override {
+        if (gptr() == egptr()) return traits_type::eof();
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+
+    static const int RECEIVE_LIMIT = 16;
+    static const std::size_t CHUNK_SIZE = 4096;
+
+    bool fill();
+
+    int fd;                      /* The client's socket               */
+    bool closed;                 /* End of stream or error seen       */
+    std::vector<char> data;      /* Unread bytes start at gptr()      */
+
+};
+
+/*
+ * Implementation notes: fill
+ * --------------------------
+ * Moves the unread bytes to the front of the buffer and makes one
+ * nonblocking recv call for at least CHUNK_SIZE more.  Returns true if it got any data.
+ * A recv that would block is not an error; anything else, including
+ * the end of the stream, marks the input as closed.
+ */
+
+bool SocketInput::fill() {
+    std::size_t unread = std::size_t(egptr() - gptr());
+    if (unread > 0 && gptr() != data.data()) std::memmove(data.data(), gptr(), unread);
+    if (data.size() < unread + CHUNK_SIZE) data.resize(unread + CHUNK_SIZE);
+    setg(data.data(), data.data(), data.data() + unread);
+    while (true) {
+        ssize_t n = ::recv(fd, data.data() + unread, data.size() - unread, MSG_DONTWAIT);
+        if (n > 0) {
+            setg(data.data(), data.data(), data.data() + unread + std::size_t(n));
+            return true;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) closed = true;
+        return false;
+    }
+}
+
+/*
+ * Type: Connection
+ * ----------------
+ * One client: its socket, the stream its lines are read from, and the
+ * session itself.  The session's output goes to the socket, and what
+ * the socket cannot take yet stays queued in the session's Output.
+ * closing is set once the session is over and only its queued output
+ * remains to be sent.
+ */
+
+struct Connection {
+
+    Connection(int fd, const ServerOptions &options)
+        : fd(fd), buffer(fd), in(&buffer), session(fd), closing(false) {
+        session.useInputQueue();
+        session.setLoadJobs(options.loadJobs);
+        session.setBudget(options.stepBudget, options.timeBudget);
+        session.setReportBreaks(false);
+        session.setFileAccess(false);
+    }
+
+    int fd;
+    SocketInput buffer;
+    std::istream in;
+    Session session;
+    bool closing;
+
+};
+
+/*
+ * Function: hungUp
+ * Usage: if (hungUp(fd)) ...
+ * --------------------------
+ * Returns true if the client has closed its end of the socket
+ * altogether.  A client that has only shut down writing is still
+ * reading the output, so that does not count.
+ */
+
+static bool hungUp(int fd) {
+    pollfd p = {fd, 0, 0};
+    return ::poll(&p, 1, 0) > 0 && (p.revents & (POLLHUP | POLLERR)) != 0;
+}
+
+/*
+ * Implementation notes: serve
+ * ---------------------------
+ * Sends what output it can, then runs the lines that have arrived on a
+ * connection, in the same way as the interactive loop in Basic.cpp,
+ * after first giving a suspended program another slice.  Nothing runs
+ * while OUTPUT_LIMIT bytes are queued.  Returns what the worker should
+ * do with the connection next: wait for more input, wait until the
+ * socket can take more output, put it back in the queue because its
+ * program is still suspended, or close it.  A suspended program whose
+ * client has hung up is not resumed or queued again, since nobody is
+ * left to read what it prints.  An exception other than an
+ * interpreter error would end the process in the interactive loop;
+ * here it only ends its own session.
+ */
+
+enum ServeResult { SERVE_WAIT, SERVE_DRAIN, SERVE_YIELD, SERVE_CLOSE };
+
+static ServeResult serve(Connection &conn) {
+    Output &out = conn.session.getState().output();
+    if (hungUp(conn.fd)) return SERVE_CLOSE;
+    out.flush();
+    if (!conn.closing && out.pending() < OUTPUT_LIMIT) {
+        conn.buffer.receive();
+        bool open = true;
+        try {
+            if (conn.session.suspended()) {
+                conn.session.resume();
+                open = !conn.session.finished();
+            }
+            std::string line;
+            while (open && !conn.session.suspended() && out.pending() < OUTPUT_LIMIT
+                   && conn.buffer.hasLine()) {
+                std::getline(conn.in, line);
+                if (line.empty() && !conn.session.waitingForInput()) {
+                    open = false;
+                } else {
+                    conn.session.processLine(line);
+                    open = !conn.session.finished();
+                }
+            }
+        } catch (std::exception &) {
+            open = false;
+        }
+        out.flush();
+        if (!open || (!conn.session.suspended() && conn.buffer.atEnd())) conn.closing = true;
+    }
+    if (conn.closing) return out.pending() > 0 ? SERVE_DRAIN : SERVE_CLOSE;
+    if (out.pending() >= OUTPUT_LIMIT) return SERVE_DRAIN;
+    if (conn.session.suspended()) return hungUp(conn.fd) ? SERVE_CLOSE : SERVE_YIELD;
+    return SERVE_WAIT;
+}
+
+/*
+ * Implementation notes: runServer
+ * -------------------------------
+ * The main thread owns the epoll loop.  Connections are registered
+ * with EPOLLONESHOT, so once a connection has been handed to a worker
+ * it produces no further events until the worker rearms it, and a
+ * session never has more than one worker.  A session whose INPUT is
+ * waiting is rearmed like any other and resumed when its line arrives.
+ * A connection with queued output is also rearmed for EPOLLOUT, and
+ * one that is draining is rearmed for nothing else, so that it is not
+ * woken again by input it will not read yet.  Workers end a session
+ * themselves, which is why a Connection is reached only through its
+ * epoll data or the queue and is never shared.  A connection whose
+ * program is suspended goes straight back to the queue without being
+ * rearmed, behind everything queued since.  Every session has a time
+ * budget, so that a slice always ends.
+ */
+
+static int fail(const char *what) {
+    std::cerr << "server: " << what << ": " << std::strerror(errno) << std::endl;
+    return 1;
+}
+
+int runServer(const std::string &path, const ServerOptions &options) {
+    std::signal(SIGPIPE, SIG_IGN);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path) {
+        std::cerr << "server: socket path too long: " << path << std::endl;
+        return 1;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) return fail("socket");
+    if (bind(listener, (sockaddr *) &address, sizeof address) < 0) return fail(path.c_str());
+    if (listen(listener, SOMAXCONN) < 0) return fail("listen");
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) return fail("epoll_create1");
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &event) < 0) return fail("epoll_ctl");
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<Connection *> queue;
+    auto work = [&]() {
+        while (true) {
+            Connection *conn;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                ready.wait(guard, [&] { return !queue.empty(); });
+                conn = queue.front();
+                queue.pop_front();
+            }
+            ServeResult result = serve(*conn);
+            if (result == SERVE_YIELD) {
+                std::lock_guard<std::mutex> guard(lock);
+                queue.push_back(conn);
+                continue;
+            }
+            if (result == SERVE_WAIT || result == SERVE_DRAIN) {
+                epoll_event rearm;
+                rearm.events = EPOLLONESHOT;
+                if (result == SERVE_WAIT) rearm.events |= EPOLLIN | EPOLLRDHUP;
+                if (conn->session.getState().output().pending() > 0) rearm.events |= EPOLLOUT;
+                rearm.data.ptr = conn;
+                if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &rearm) == 0) continue;
+            }
+            int fd = conn->fd;
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+            delete conn;
+            close(fd);
+        }
+    };
+    ServerOptions sessionOptions = options;
+    if (sessionOptions.timeBudget.count() <= 0) sessionOptions.timeBudget = DEFAULT_TIME_SLICE;
+    int workers = options.workers;
+    if (workers <= 0) workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> pool;
+    for (int i = 0; i < workers; i++) pool.emplace_back(work);
+
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return fail("epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr != nullptr) {
+                std::lock_guard<std::mutex> guard(lock);
+                queue.push_back((Connection *) events[i].data.ptr);
+                ready.notify_one();
+                continue;
+            }
+            while (true) {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                Connection *conn = new Connection(fd, sessionOptions);
+                epoll_event watch;
+                watch.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                watch.data.ptr = conn;
+                if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &watch) < 0) {
+                    delete conn;
+                    close(fd);
+                }
+            }
+        }
+    }
+}
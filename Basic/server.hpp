@@ -0,0 +1,82 @@
+/*
+ * File: server.h
+ * --------------
+ * This interface exports runServer, which serves interpreter sessions
+ * over a Unix domain socket.
+ */
+
+#ifndef _server_h
+#define _server_h
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+/*
+ * Constant: DEFAULT_TIME_SLICE
+ * ----------------------------
+ * The time a program runs for before its worker moves on, when the
+ * options do not give a time budget.
+ */
+
+const std::chrono::milliseconds DEFAULT_TIME_SLICE(10);
+
+/*
+ * Constant: OUTPUT_LIMIT
+ * ----------------------
+ * The number of unsent bytes at which a session stops running until
+ * its client reads.
+ */
+
+const std::size_t OUTPUT_LIMIT = 256 * 1024;
+
+/*
+ * Type: ServerOptions
+ * -------------------
+ * How the server runs its sessions.  workers is the number of worker
+ * threads (one per CPU if 0) and loadJobs the number of threads LOAD
+ * parses with.  stepBudget and timeBudget limit the slice a program
+ * runs for before its worker moves on (see Program::setBudget).  A
+ * stepBudget of zero means no limit on steps; a timeBudget of zero
+ * means DEFAULT_TIME_SLICE, since every slice must end.
+ */
+
+struct ServerOptions {
+    int workers = 0;
+    int loadJobs = 0;
+    long long stepBudget = 0;
+    std::chrono::nanoseconds timeBudget{0};
+};
+
+/*
+ * Function: runServer
+ * Usage: int status = runServer(path, options);
+ * ---------------------------------------------
+ * Listens on the Unix domain socket path and gives every connection a
+ * Session of its own.  A client writes lines exactly as it would type
+ * them to the interpreter and reads back what the interpreter prints;
+ * INPUT reads the next line from the same connection.  A session ends
+ * with QUIT, an empty line or the end of the connection, and the
+ * server closes the connection; the server itself keeps running until
+ * it is killed.
+ *
+ * Connections are watched by one epoll loop, and lines that arrive are
+ * processed by a pool of worker threads.  A session is handled by one
+ * worker at a time, so it sees its lines in order.  A program that
+ * reaches INPUT before its line has arrived is suspended, and the
+ * worker moves on until the line comes.  A program that uses up its
+ * slice is suspended too, and its session goes to the back of the
+ * queue of sessions waiting for a worker, so a program that never
+ * stops cannot hold a worker while others wait.  Sockets never block:
+ * output the client has not read yet is queued with its session, and
+ * a session with more than OUTPUT_LIMIT bytes queued is not run again
+ * until the client has read some of them.  Either way the client sees
+ * the same output as if the program had run straight through.  A
+ * stale socket left at path by an earlier server is
+ * replaced.  Returns a nonzero exit status, after reporting the problem
+ * on standard error, if the socket cannot be set up.
+ */
+
+int runServer(const std::string &path, const ServerOptions &options);
+
+#endif
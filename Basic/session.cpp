@@ -0,0 +1,269 @@
+/*
+ * File: session.cpp
+ * -----------------
+ * This file implements the Session class.  processLine used to be the
+ * main loop's helper in Basic.cpp; it moved here so that the server can
+ * run one session per connection.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <string>
+#include "session.hpp"
+#include "allocstats.hpp"
+#include "arena.hpp"
+#include "image.hpp"
+#include "loader.hpp"
+#include "statement.hpp"
+#include "Utils/error.hpp"
+#include "Utils/tokenScanner.hpp"
+
+Session::Session(int fd) : state(fd), execution(program, state) {
+    pendingInput = nullptr;
+    loadJobs = 0;
+    quit = false;
+    reportBreaks = true;
+    fileAccess = true;
+}
+
+bool Session::finished() const {
+    return quit;
+}
+
+void Session::setInput(std::istream &in) {
+    state.setInput(in);
+}
+
+void Session::useInputQueue() {
+    state.useInputQueue();
+}
+
+bool Session::waitingForInput() const {
+    return state.waitingForInput();
+}
+
+void Session::setLoadJobs(int jobs) {
+    loadJobs = jobs;
+}
+
+Program &Session::getProgram() {
+    return program;
+}
+
+EvalState &Session::getState() {
+    return state;
+}
+
+void Session::setBudget(long long steps, std::chrono::nanoseconds time) {
+    execution.setBudget(steps, time);
+}
+
+void Session::setReportBreaks(bool report) {
+    reportBreaks = report;
+}
+
+void Session::setFileAccess(bool allow) {
+    fileAccess = allow;
+}
+
+bool Session::suspended() const {
+    return execution.status() == EXEC_SUSPENDED;
+}
+
+void Session::resume() {
+    try {
+        execute(true);
+    } catch (ErrorException &ex) {
+        report(ex);
+    }
+}
+
+void Session::processLine(const std::string &line) {
+    try {
+        if (waitingForInput()) {
+            answer(line);
+        } else {
+            interpret(line);
+        }
+    } catch (ErrorException &ex) {
+        report(ex);
+    }
+}
+
+void Session::report(ErrorException &ex) {
+    state.output() << ex.getMessage() << '\n';
+    state.output().flush();
+}
+
+/*
+ * Function: fileArgument
+ * Usage: std::string filename = fileArgument(line, pos);
+ * ------------------------------------------------------
+ * Returns the file name given to LOAD or SAVE, which is the rest of
+ * the line after position pos with surrounding blanks and quotes
+ * removed.
+ */
+
+static std::string fileArgument(std::string_view line, int pos) {
+    std::string_view arg = line.substr(std::min<std::size_t>(pos, line.size()));
+    while (!arg.empty() && std::isspace((unsigned char) arg.front())) arg.remove_prefix(1);
+    while (!arg.empty() && std::isspace((unsigned char) arg.back())) arg.remove_suffix(1);
+    if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') {
+        arg = arg.substr(1, arg.size() - 2);
+    }
+    if (arg.empty()) error("SYNTAX ERROR");
+    return std::string(arg);
+}
+
+/*
+ * Implementation notes: interpret
+ * -------------------------------
+ * Numbered lines are stored in the program, with their statement if
+ * they parse; RUN, CONT, LOAD, SAVE and ALLOCS are carried out here,
+ * and any other immediate command is parsed into a temporary arena and
+ * executed.  QUIT only marks the session as finished.
+ */
+
+void Session::interpret(const std::string &line) {
+    TokenScanner scanner;
+    scanner.ignoreWhitespace();
+    scanner.scanNumbers();
+    scanner.setInputView(line);
+
+    std::string_view it1=scanner.nextTokenView().text;
+    int lineNumber;
+    Statement* stmt;
+    std::string_view token;
+    if(!isNumeric(it1)){
+        lineNumber = -1;
+        token = it1;
+    }
+    else {
+        lineNumber = std::stoi(std::string(it1));
+        //错误：处理只输入了一个数字的情况
+        if(line==it1) {
+            program.removeSourceLine(lineNumber);
+            //错误：return要放在里层if的外面
+            return;
+        }
+        program.addSourceLine(lineNumber,line);
+        stmt = nullptr;
+        token = scanner.nextTokenView().text;
+    }
+
+    Keyword keyword = lookupKeyword(token);
+    if (keyword == KW_RUN) {
+        execute(false);
+        return;
+    }
+    if (keyword == KW_CONT && lineNumber == -1) {
+        execute(true);
+        return;
+    }
+    if ((keyword == KW_LOAD || keyword == KW_SAVE) && lineNumber == -1 && !fileAccess) {
+        error("FILE ACCESS DENIED");
+    }
+    if (keyword == KW_LOAD && lineNumber == -1) {
+        loadProgram(fileArgument(line, scanner.getPosition()), program, state, loadJobs);
+        state.output().flush();
+        return;
+    }
+    if (keyword == KW_SAVE && lineNumber == -1) {
+        saveImage(fileArgument(line, scanner.getPosition()), program);
+        return;
+    }
+    // ALLOCS 只在统计内存分配的构建中存在：输出上次 ALLOCS 以来各子系统的分配次数并清零
+    if (countingAllocations && keyword == KW_ALLOCS && lineNumber == -1) {
+        state.output() << allocationReport();
+        state.output().flush();
+        resetAllocationCounts();
+        return;
+    }
+
+    // 立即命令的语句和表达式分配在自己的 arena 中，执行完（或出错）后随 arena 一起释放；
+    // 程序行则分配在 program 的行 arena 中，由 program 保管
+    std::unique_ptr<Arena> arena;
+    {
+        AllocScope scope(ALLOC_PARSER);
+        Arena *target;
+        if(lineNumber!=-1){
+            target=&program.lineArena();
+        }
+        else{
+            arena = std::make_unique<Arena>();
+            target=arena.get();
+        }
+        stmt = parseStatement(keyword, scanner, *target, state);
+    }
+
+    // 将解析后的语句存储到容器中（无法识别的立即命令不存储）
+
+    if(lineNumber!=-1){
+        program.setParsedStatement(lineNumber,stmt);
+        return;
+    }
+    if(stmt==nullptr) return;
+    if(keyword==KW_QUIT){
+        state.output().flush();
+        quit=true;
+        return;
+    }
+    if(keyword==KW_GOTO||keyword==KW_IF) stmt->link(program);
+    AllocScope scope(ALLOC_EVAL);
+    stmt->execute(state,program);
+    if(keyword==KW_REM) state.output()<<"SYNTAX ERROR\n";
+    // 直接输入的 INPUT 没等到输入行：保留语句，下一行到来时再执行
+    if(state.waitingForInput()){
+        program.whether_stop=false;
+        pendingInput=stmt;
+        pendingArena=std::move(arena);
+    }
+}
+
+/*
+ * Implementation notes: answer
+ * ----------------------------
+ * Hands a line to the INPUT that is waiting for it, which is either a
+ * suspended program or an INPUT typed directly.  The INPUT runs again
+ * and this time finds the line; if the line is not a number it asks
+ * again and waits once more.
+ */
+
+void Session::answer(const std::string &line) {
+    execution.provideInput(line);
+    if(pendingInput==nullptr){
+        execute(true);
+        return;
+    }
+    Statement *stmt=pendingInput;
+    std::unique_ptr<Arena> arena=std::move(pendingArena);
+    pendingInput=nullptr;
+    AllocScope scope(ALLOC_EVAL);
+    stmt->execute(state,program);
+    if(state.waitingForInput()){
+        program.whether_stop=false;
+        pendingInput=stmt;
+        pendingArena=std::move(arena);
+    }
+}
+
+/*
+ * Implementation notes: execute
+ * -----------------------------
+ * Runs a slice of the program for RUN or CONT.  A QUIT in the program
+ * ends the session once the slice is over.
+ */
+
+void Session::execute(bool resuming) {
+    ExecStatus status=resuming?execution.resume():execution.run();
+    if(reportBreaks && status==EXEC_SUSPENDED){
+        state.output()<<"BREAK IN "<<execution.line()<<'\n';
+    }
+    state.output().flush();
+    if(program.quit_requested){
+        program.quit_requested=false;
+        quit=true;
+    }
+}
+
@@ -0,0 +1,197 @@
+/*
+ * File: session.h
+ * ---------------
+ * This interface exports the Session class, which holds everything
+ * one user of the interpreter works with: a program, its variables and
+ * the streams it reads and writes.
+ */
+
+#ifndef _session_h
+#define _session_h
+
+#include <chrono>
+#include <istream>
+#include <memory>
+#include <string>
+#include "arena.hpp"
+#include "evalstate.hpp"
+#include "execution.hpp"
+#include "program.hpp"
+#include "Utils/error.hpp"
+
+/*
+ * Class: Session
+ * --------------
+ * Interprets the lines a user types, one at a time, as the command-line
+ * interpreter always has: numbered lines edit the program and anything
+ * else is executed at once.  Sessions share no mutable state, not even
+ * the table that maps variable names to slots (see Symbols), so
+ * several of them can run on different threads and the variables of
+ * one never take up room in another.
+ */
+
+class Session {
+
+public:
+
+/*
+ * Constructor: Session
+ * Usage: Session session;
+ *        Session session(fd);
+ * ---------------------------
+ * Creates a session with an empty program that writes its output to
+ * fd (standard output by default) and reads INPUT from standard input.
+ */
+
+    explicit Session(int fd = 1);
+
+/*
+ * Method: processLine
+ * Usage: session.processLine(line);
+ * ---------------------------------
+ * Processes a single line entered by the user.  Errors are reported on
+ * the session's output, after which the session goes on as before.
+ * While INPUT is waiting for a line from the queue (see useInputQueue),
+ * the line is the answer, and the program goes on with it.
+ */
+
+    void processLine(const std::string &line);
+
+/*
+ * Method: finished
+ * Usage: if (session.finished()) . . .
+ * ------------------------------------
+ * Returns true once QUIT has been executed, either typed directly or
+ * in a program.  QUIT never ends the process itself; whoever reads the
+ * lines stops when the session is finished.
+ */
+
+    bool finished() const;
+
+/*
+ * Method: setInput
+ * Usage: session.setInput(in);
+ * ----------------------------
+ * Makes INPUT read from in, which must outlive the session.
+ */
+
+    void setInput(std::istream &in);
+
+/*
+ * Method: useInputQueue
+ * Usage: session.useInputQueue();
+ * -------------------------------
+ * Makes INPUT read the lines given to processLine instead of a stream.
+ * An INPUT that has no line yet does not wait for one: processLine
+ * returns with the session waiting for input, and the caller is free
+ * to do other work until the next line arrives.
+ */
+
+    void useInputQueue();
+
+/*
+ * Method: waitingForInput
+ * Usage: if (session.waitingForInput()) . . .
+ * -------------------------------------------
+ * Returns true if INPUT, in a program or typed directly, is waiting
+ * for the next line.
+ */
+
+    bool waitingForInput() const;
+
+/*
+ * Method: setLoadJobs
+ * Usage: session.setLoadJobs(jobs);
+ * ---------------------------------
+ * Sets the number of threads LOAD parses with; 0, the default, lets
+ * the loader decide.
+ */
+
+    void setLoadJobs(int jobs);
+
+/*
+ * Method: setBudget
+ * Usage: session.setBudget(steps, time);
+ * --------------------------------------
+ * Limits each slice of a running program (see Program::setBudget).
+ * When RUN or CONT runs out of budget, processLine prints BREAK IN
+ * and the line number, and returns with the program suspended; CONT,
+ * or resume, goes on from where it stopped.
+ */
+
+    void setBudget(long long steps, std::chrono::nanoseconds time);
+
+/*
+ * Method: setReportBreaks
+ * Usage: session.setReportBreaks(false);
+ * --------------------------------------
+ * Turns the BREAK IN message off, for callers that resume a suspended
+ * program themselves.
+ */
+
+    void setReportBreaks(bool report);
+
+/*
+ * Method: setFileAccess
+ * Usage: session.setFileAccess(false);
+ * ------------------------------------
+ * Turns LOAD and SAVE on or off.  They are on by default; with them
+ * off, both report FILE ACCESS DENIED, which keeps a session whose
+ * lines come from someone else away from the files of the process.
+ */
+
+    void setFileAccess(bool allow);
+
+/*
+ * Method: suspended
+ * Usage: if (session.suspended()) . . .
+ * -------------------------------------
+ * Returns true if the program ran out of budget and can be resumed.
+ */
+
+    bool suspended() const;
+
+/*
+ * Method: resume
+ * Usage: session.resume();
+ * ------------------------
+ * Runs the next slice of a suspended program, exactly as if CONT had
+ * been typed.  Errors are reported as they are by processLine.
+ */
+
+    void resume();
+
+/*
+ * Methods: getProgram, getState
+ * Usage: Program &program = session.getProgram();
+ * -----------------------------------------------
+ * Return the session's program and evaluation state.
+ */
+
+    Program &getProgram();
+
+    EvalState &getState();
+
+private:
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    void interpret(const std::string &line);
+    void answer(const std::string &line);
+    void execute(bool resuming);
+    void report(ErrorException &ex);
+
+    EvalState state;              /* Variables and output             */
+    Program program;              /* The lines entered so far         */
+    Execution execution;          /* Runs the program in slices       */
+    std::unique_ptr<Arena> pendingArena;  /* Holds pendingInput       */
+    Statement *pendingInput;      /* INPUT typed directly, waiting    */
+    int loadJobs;                 /* Threads for LOAD, 0 = automatic  */
+    bool quit;                    /* Set by QUIT                      */
+    bool reportBreaks;            /* Print BREAK IN when suspended    */
+    bool fileAccess;              /* LOAD and SAVE are allowed        */
+
+};
+
+#endif
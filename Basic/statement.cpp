@@ -8,11 +8,15 @@
  */
 
 #include "statement.hpp"
+#include "allocstats.hpp"
 #include "evalstate.hpp"
 #include "exp.hpp"
+#include "image.hpp"
+#include "optimizer.hpp"
 #include "program.hpp"
 #include "Utils/strlib.hpp"
 #include <string>
+#include <utility>
 
 
 /* Implementation of the Statement class */
@@ -23,46 +27,88 @@ Statement::Statement() = default;
 
 Statement::~Statement() = default;
 
+void Statement::link(const Program &program){}
+
+void Statement::save(ImageWriter &out){
+    out.word(KW_NONE);
+}
+
 void REM::execute(EvalState &state,Program &program){}
-LET::LET(std::string str_in,Expression* ex_in){
+void REM::emitThreaded(ThreadedCode &out){}
+void REM::save(ImageWriter &out){
+    out.word(KW_REM);
+}
+LET::LET(std::string str_in,int slot_in,Expression* ex_in,bool reserved_in){
     str=str_in;
+    slot=slot_in;
+    reserved=reserved_in;
     ex=ex_in;
+    compileExp(ex,code);
+    if(reserved) code.emit(OP_SYNTAX_ERROR);
+    else code.emit(OP_LET,slot);
+    code.emit(OP_RETURN);
 }
 void LET::execute(EvalState &state,Program &program){
+    if(useBytecode){
+        runChunk(code,state,program);
+        return;
+    }
     try{
-        int value1=ex->eval(state);
+        Value value1=ex->eval(state);
 //        delete ex;
         //错误：要看这里有没有定义过这个变量
-        if(str=="LET"||str=="REM"||str=="PRINT"||str=="INPUT"||str=="END"||str=="GOTO"||str=="IF"||str=="RUN"||str=="LIST"||str=="CLEAR"||str=="QUIT"||str=="HELP"){
-            std::cout<<"SYNTAX ERROR"<<std::endl;
+        if(reserved){
+            state.output()<<"SYNTAX ERROR\n";
             return;
         }
-        state.setValue(str,value1);
+        state.setValue(slot,value1);
     }
     catch(...){throw;}
 }
-LET::~LET(){
-    delete ex;
+void LET::emitThreaded(ThreadedCode &out){
+    out.emitChunk(code);
+}
+void LET::save(ImageWriter &out){
+    out.word(KW_LET);
+    out.symbol(str);
+    out.expression(ex);
 }
 PRINT::PRINT(Expression* expression){
     a=expression;
+    compileExp(a,code);
+    code.emit(OP_PRINT);
+    code.emit(OP_RETURN);
 }
 
 void PRINT::execute(EvalState &state,Program &program){
+    if(useBytecode){
+        runChunk(code,state,program);
+        return;
+    }
     try{
-        std::cout<<a->eval(state)<<std::endl;
+        state.output()<<a->eval(state)<<'\n';
     }
     catch(...){
         throw;
     }
 //    std::cout<<a->eval(state)<<std::endl;
 }
-INPUT::INPUT(std::string variable){
+void PRINT::emitThreaded(ThreadedCode &out){
+    out.emitChunk(code);
+}
+void PRINT::save(ImageWriter &out){
+    out.word(KW_PRINT);
+    out.expression(a);
+}
+INPUT::INPUT(std::string variable,int slot_in){
     str=variable;
+    slot=slot_in;
+    code.emit(OP_INPUT,slot);
+    code.emit(OP_RETURN);
 }
-bool isNumeric(const std::string& str) {
-    if(str[0]=='-'||str[0]=='+'){
-        for(int i=1;i<str.size();++i){
+bool isNumeric(std::string_view str) {
+    if(!str.empty() && (str[0]=='-'||str[0]=='+')){
+        for(std::size_t i=1;i<str.size();++i){
             if(!std::isdigit(str[i])){
                 return false;
             }
@@ -77,96 +123,488 @@ bool isNumeric(const std::string& str) {
     }
     return true;
 }
-void INPUT::execute(EvalState &state,Program &program){
-    int num;
+// 输入队列为空时返回 0 并让 state 处于等待输入状态，由调用者挂起程序；
+// 再次执行时不重复输出提示符
+Value readInputNumber(EvalState &state){
+    Value num;
     std::string str_in;
     while(true){
-        std::cout<<" ? ";
-        getline(std::cin,str_in);
+        if(!state.waitingForInput()){
+            state.output()<<" ? ";
+            state.output().flush();
+        }
+        if(!state.readLine(str_in)) return 0;
         if(isNumeric(str_in)){
-            num=std::stoi(str_in);
+            num=useInt64?std::stoll(str_in):std::stoi(str_in);
             break;
         }
         else{
-            std::cout<<"INVALID NUMBER"<<std::endl;
+            state.output()<<"INVALID NUMBER\n";
         }
     }
-    state.setValue(str,num);
+    return num;
+}
+void INPUT::execute(EvalState &state,Program &program){
+    if(useBytecode){
+        runChunk(code,state,program);
+        return;
+    }
+    Value value=readInputNumber(state);
+    if(state.waitingForInput()){
+        program.whether_stop=true;
+        return;
+    }
+    state.setValue(slot,value);
+}
+void INPUT::emitThreaded(ThreadedCode &out){
+    out.emitChunk(code);
+}
+void INPUT::save(ImageWriter &out){
+    out.word(KW_INPUT);
+    out.symbol(str);
+}
+END::END(){
+    code.emit(OP_END);
+    code.emit(OP_RETURN);
 }
 void END::execute(EvalState &state,Program &program){
+    if(useBytecode){
+        runChunk(code,state,program);
+        return;
+    }
     //错误：不会立即执行，会使RUN终止
     program.whether_stop=true;
 }
+void END::emitThreaded(ThreadedCode &out){
+    out.emitChunk(code);
+}
+void END::save(ImageWriter &out){
+    out.word(KW_END);
+}
 GOTO::GOTO(int value_in){
     value=value_in;
+    target=-1;
+    code.emit(OP_GOTO,code.addTarget(value));
+    code.emit(OP_RETURN);
 }
 void GOTO::execute(EvalState &state,Program &program){
-    if(program.exist_line.count(value)==0){
+    if(useBytecode){
+        runChunk(code,state,program);
+        return;
+    }
+    if(target<0){
         error("LINE NUMBER ERROR");
     }
-    else program.current_line=value;
+    else program.jump_index=target;
+}
+void GOTO::link(const Program &program){
+    target=program.indexOf(value);
+    code.link(program);
+}
+void GOTO::emitThreaded(ThreadedCode &out){
+    out.emitChunk(code);
+}
+void GOTO::save(ImageWriter &out){
+    out.word(KW_GOTO);
+    out.word(uint32_t(value));
 }
-IF::IF(Expression* a,Expression* b,std::string str,int line_in){
+IF::IF(Expression* a,Expression* b,Operator op,int line_in){
     e1=a;
     e2=b;
     line=line_in;
-    cmp=str;
+    target=-1;
+    constantTarget=true;
+    cmp=op;
+    compileExp(e1,code);
+    compileExp(e2,code);
+    switch(cmp){
+        case LT_OP: code.emit(OP_IF_LT,code.addTarget(line)); break;
+        case GT_OP: code.emit(OP_IF_GT,code.addTarget(line)); break;
+        case EQ_OP: code.emit(OP_IF_EQ,code.addTarget(line)); break;
+        default: break;
+    }
+    code.emit(OP_RETURN);
 }
 void IF::execute(EvalState &state,Program &program){
-    int value1=e1->eval(state);
-    int value2=e2->eval(state);
+    if(useBytecode){
+        runChunk(code,state,program);
+        return;
+    }
+    Value value1=e1->eval(state);
+    Value value2=e2->eval(state);
 //    delete e1;
 //    delete e2;
     bool flag = false;
-    if(cmp==">" && value1>value2) flag=true;
-    if(cmp=="<" && value1<value2) flag=true;
-    if(cmp=="=" && value1==value2) flag=true;
+    switch(cmp){
+        case GT_OP: flag = value1>value2; break;
+        case LT_OP: flag = value1<value2; break;
+        case EQ_OP: flag = value1==value2; break;
+        default: break;
+    }
     if(flag==true){
-        if(program.exist_line.count(line)==0){
+        if(target<0){
             error("LINE NUMBER ERROR");
         }
         else{
-            program.current_line=line;
+            program.jump_index=target;
         }
     }
 }
-IF::~IF(){
-    delete e1;
-    delete e2;
+void IF::link(const Program &program){
+    target=program.indexOf(line);
+    code.link(program);
 }
-void RUN::execute(EvalState &state,Program &program){
-    auto it=program.exist_line.begin();
-    while(it!=program.exist_line.end()){
-        program.processed_line[*it]->execute(state,program);
-        if(program.whether_stop==true) break;
-        if(program.current_line!=0){
-            it = program.exist_line.find(program.current_line);
-            program.current_line=0;
-            //错误：continue不能漏
-            continue;
+void IF::emitThreaded(ThreadedCode &out){
+    out.emitChunk(code);
+}
+//目标行是表达式时，解析 IF 会对它求值（可能给变量赋值），所以这样的行在载入映像时重新解析
+void IF::save(ImageWriter &out){
+    if(!constantTarget){
+        Statement::save(out);
+        return;
+    }
+    out.word(KW_IF);
+    out.expression(e1);
+    out.expression(e2);
+    out.word(cmp);
+    out.word(uint32_t(line));
+}
+LET_ADD::LET_ADD(std::string str_in,int slot_in,Expression* ex_in,int source_in,int constant_in)
+    :LET(str_in,slot_in,ex_in,false){
+    source=source_in;
+    constant=constant_in;
+}
+
+void LET_ADD::execute(EvalState &state,Program &program){
+    if(!useBytecode){
+        LET::execute(state,program);
+        return;
+    }
+    if(!state.isDefined(source)) error("VARIABLE NOT DEFINED");
+    state.setValue(slot,addValues(state.getValue(source),constant));
+}
+void LET_ADD::emitThreaded(ThreadedCode &out){
+    out.emit(OP_ADD_CONST,slot,source,constant);
+}
+IF_CONST::IF_CONST(Expression* a,Expression* b,Operator op,int line_in)
+    :IF(a,b,op,line_in){
+    constantFirst=a->getType()==CONSTANT;
+    Expression *var=constantFirst?b:a;
+    Expression *value=constantFirst?a:b;
+    slot=((IdentifierExp *) var)->getSlot();
+    constant=int(((ConstantExp *) value)->getValue());
+}
+void IF_CONST::execute(EvalState &state,Program &program){
+    if(!useBytecode){
+        IF::execute(state,program);
+        return;
+    }
+    if(!state.isDefined(slot)) error("VARIABLE NOT DEFINED");
+    Value value1=state.getValue(slot);
+    Value value2=constant;
+    if(constantFirst) std::swap(value1,value2);
+    bool flag=false;
+    switch(cmp){
+        case GT_OP: flag = value1>value2; break;
+        case LT_OP: flag = value1<value2; break;
+        case EQ_OP: flag = value1==value2; break;
+        default: break;
+    }
+    if(flag){
+        if(target<0) error("LINE NUMBER ERROR");
+        program.jump_index=target;
+    }
+}
+
+/*
+ * Implementation notes: IF_CONST::emitThreaded
+ * --------------------------------------------
+ * A comparison written with the constant first is turned around so
+ * that the fused instruction always has the variable on the left.  An
+ * IF without a valid comparison never jumps, but still evaluates its
+ * operands, so it keeps its general code.
+ */
+
+void IF_CONST::emitThreaded(ThreadedCode &out){
+    OpCode op;
+    switch(cmp){
+        case LT_OP: op=constantFirst?OP_IF_CONST_GT:OP_IF_CONST_LT; break;
+        case GT_OP: op=constantFirst?OP_IF_CONST_LT:OP_IF_CONST_GT; break;
+        case EQ_OP: op=OP_IF_CONST_EQ; break;
+        default:
+            out.emitChunk(code);
+            return;
+    }
+    out.emitJump(op,slot,constant,target);
+}
+
+/*
+ * Implementation notes: newLET, newIF
+ * -----------------------------------
+ * Like newCompoundExp, these choose the class that implements a
+ * statement from the shape of its expressions.  A LET that assigns to
+ * a reserved word keeps the general class, which reports the SYNTAX
+ * ERROR after evaluating the value.  In 32-bit mode subtracting c is
+ * the same as adding -c, wrapped around, even for INT_MIN; in 64-bit
+ * mode -c itself must fit in an int.
+ */
+
+static Statement *newLET(Arena &arena,const std::string &name,int slot,Expression *exp){
+    bool reserved=isReservedWord(name);
+    if(exp->getType()==COMPOUND && !reserved){
+        CompoundExp *cexp=(CompoundExp *) exp;
+        Operator op=cexp->getOperator();
+        Expression *lhs=cexp->getLHS();
+        Expression *rhs=cexp->getRHS();
+        if(op==ADD_OP && lhs->getType()==CONSTANT && rhs->getType()==IDENTIFIER){
+            std::swap(lhs,rhs);
+        }
+        if((op==ADD_OP||op==SUB_OP) && lhs->getType()==IDENTIFIER && rhs->getType()==CONSTANT){
+            int source=((IdentifierExp *) lhs)->getSlot();
+            Value constant=((ConstantExp *) rhs)->getValue();
+            if(op==SUB_OP && fitsInt(constant)) constant=useInt64?-constant:subValues(0,constant);
+            if(fitsInt(constant)) return arena.make<LET_ADD>(name,slot,exp,source,int(constant));
         }
-        it++;
     }
+    return arena.make<LET>(name,slot,exp,reserved);
+}
+static IF *newIF(Arena &arena,Expression *a,Expression *b,Operator op,int line){
+    bool varConst=a->getType()==IDENTIFIER && b->getType()==CONSTANT;
+    bool constVar=a->getType()==CONSTANT && b->getType()==IDENTIFIER;
+    if(varConst||constVar){
+        Expression *value=varConst?b:a;
+        if(fitsInt(((ConstantExp *) value)->getValue())) return arena.make<IF_CONST>(a,b,op,line);
+    }
+    return arena.make<IF>(a,b,op,line);
+}
+void RUN::execute(EvalState &state,Program &program){
+    program.run(state);
 }
 void LIST::execute(EvalState &state,Program &program){
-    for(auto it=program.exist_line.begin();it!=program.exist_line.end();++it){
-        std::cout<<program.original_line[*it]<<std::endl;
+    for(int i=0;i<program.size();++i){
+        state.output()<<program.lineAt(i).source<<'\n';
     }
 }
+void LIST::save(ImageWriter &out){
+    out.word(KW_LIST);
+}
 void CLEAR::execute(EvalState &state,Program &program){
     program.clear();
     state.Clear();
 }
+void CLEAR::save(ImageWriter &out){
+    out.word(KW_CLEAR);
+}
+//QUIT 不直接退出进程：停止运行并交给会话结束（服务器模式下只结束当前连接）
 void QUIT::execute(EvalState &state,Program &program){
-
-    program.clear();
-    state.Clear();
-    exit(0);
+    program.quit_requested=true;
+    program.whether_stop=true;
+}
+void QUIT::save(ImageWriter &out){
+    out.word(KW_QUIT);
 }
 
 //在quit的时候释放内存
 void HELP::execute(EvalState &state,Program &program){
-    std::cout << "Yet another basic interpreter" << std::endl;
+    state.output() << "Yet another basic interpreter\n";
+}
+void HELP::save(ImageWriter &out){
+    out.word(KW_HELP);
+}
+
+/*
+ * Implementation notes: statement factories
+ * -----------------------------------------
+ * Each factory builds one kind of statement from the rest of its line.
+ * Expressions are simplified by optimizeExp before the statement is
+ * built, so that a statement that becomes one of the fused shapes is
+ * created as one.
+ */
+
+static Statement *parseLET(TokenScanner &scanner,Arena &arena,EvalState &state){
+    std::string str_in(scanner.nextTokenView().text);
+    scanner.nextTokenView();
+    //注意如果没有定义，那么会输出 VARIABLE NOT DEFINED
+    //错误：value_in不能放在外面，应该放在里面，只能传入expression*
+    Expression* expression = optimizeExp(parseExp(scanner,arena,state.symbols()),arena);
+    return newLET(arena,str_in,state.symbols().intern(str_in),expression);
+}
+static Statement *parsePRINT(TokenScanner &scanner,Arena &arena,EvalState &state){
+    Expression* expression = optimizeExp(parseExp(scanner,arena,state.symbols()),arena);
+    return arena.make<PRINT>(expression);
+}
+static Statement *parseINPUT(TokenScanner &scanner,Arena &arena,EvalState &state){
+    std::string variable(scanner.nextTokenView().text);
+    return arena.make<INPUT>(variable,state.symbols().intern(variable));
+}
+static Statement *parseEND(TokenScanner &scanner,Arena &arena,EvalState &state){
+    return arena.make<END>();
+}
+static Statement *parseGOTO(TokenScanner &scanner,Arena &arena,EvalState &state){
+    std::string str1(scanner.nextTokenView().text);
+    return arena.make<GOTO>(std::stoi(str1));
+}
+static Statement *parseIF(TokenScanner &scanner,Arena &arena,EvalState &state){
+    Expression* a = optimizeExp(readE(scanner,arena,state.symbols(),1),arena);
+    std::string_view str= scanner.nextTokenView().text;
+    Expression* b = optimizeExp(readE(scanner,arena,state.symbols(),1),arena);
+    scanner.nextTokenView();
+    Expression* c = readE(scanner,arena,state.symbols());
+    int line_in = int(c->eval(state));
+    //错误：在传入时只能传入Expression*类型的，因为不然可能还没有创建这个变量
+    IF *stmt = newIF(arena, a, b, toComparison(str), line_in);
+    stmt->constantTarget = c->getType()==CONSTANT;
+    return stmt;
+}
+static Statement *parseREM(TokenScanner &scanner,Arena &arena,EvalState &state){
+    // 错误：这里只要构造一个REM就行，不用再进行其他操作
+    return arena.make<REM>();
+}
+static Statement *parseLIST(TokenScanner &scanner,Arena &arena,EvalState &state){
+    return arena.make<LIST>();
+}
+static Statement *parseCLEAR(TokenScanner &scanner,Arena &arena,EvalState &state){
+    return arena.make<CLEAR>();
+}
+static Statement *parseQUIT(TokenScanner &scanner,Arena &arena,EvalState &state){
+    return arena.make<QUIT>();
+}
+static Statement *parseHELP(TokenScanner &scanner,Arena &arena,EvalState &state){
+    return arena.make<HELP>();
 }
 
+/*
+ * Implementation notes: keyword registry
+ * --------------------------------------
+ * KEYWORDS holds one entry per Keyword, in the order of the enum, so
+ * an entry is found from its keyword by indexing.  A new statement
+ * type needs an enumerator, an entry and a factory.  Entries without a
+ * factory are commands handled by processLine.
+ *
+ * Finding the keyword for a token uses a hash table of KEYWORD_SLOTS
+ * entries built on first use.  The hash mixes the length with the
+ * first and last characters, which separates the current keywords
+ * without any collisions, so a lookup compares at most one string;
+ * linear probing keeps the table correct if a later keyword collides.
+ */
 
+typedef Statement *(*StatementFactory)(TokenScanner &scanner,Arena &arena,EvalState &state);
+
+struct KeywordEntry{
+    std::string_view name;
+    Keyword keyword;
+    bool reserved;
+    StatementFactory factory;
+};
+
+static const KeywordEntry KEYWORDS[]={
+    {"",KW_NONE,false,nullptr},
+    {"LET",KW_LET,true,parseLET},
+    {"PRINT",KW_PRINT,true,parsePRINT},
+    {"INPUT",KW_INPUT,true,parseINPUT},
+    {"END",KW_END,true,parseEND},
+    {"GOTO",KW_GOTO,true,parseGOTO},
+    {"IF",KW_IF,true,parseIF},
+    {"REM",KW_REM,true,parseREM},
+    {"RUN",KW_RUN,true,nullptr},
+    {"LIST",KW_LIST,true,parseLIST},
+    {"CLEAR",KW_CLEAR,true,parseCLEAR},
+    {"QUIT",KW_QUIT,true,parseQUIT},
+    {"HELP",KW_HELP,true,parseHELP},
+    {"LOAD",KW_LOAD,false,nullptr},
+    {"ALLOCS",KW_ALLOCS,false,nullptr},
+    {"CONT",KW_CONT,false,nullptr},
+    {"SAVE",KW_SAVE,false,nullptr},
+};
+
+static const int KEYWORD_COUNT=int(sizeof KEYWORDS/sizeof KEYWORDS[0]);
+static const int KEYWORD_SLOTS=32;
+
+static unsigned keywordHash(std::string_view token){
+    return unsigned(token.size()*10+(unsigned char) token.front()*6+(unsigned char) token.back())
+           %KEYWORD_SLOTS;
+}
+
+struct KeywordTable{
+    Keyword slots[KEYWORD_SLOTS];
+    KeywordTable(){
+        for(Keyword &slot:slots) slot=KW_NONE;
+        for(int k=1;k<KEYWORD_COUNT;k++){
+            unsigned h=keywordHash(KEYWORDS[k].name);
+            while(slots[h]!=KW_NONE) h=(h+1)%KEYWORD_SLOTS;
+            slots[h]=KEYWORDS[k].keyword;
+        }
+    }
+};
+
+Keyword lookupKeyword(std::string_view token){
+    static const KeywordTable table;
+    if(token.empty()) return KW_NONE;
+    for(unsigned h=keywordHash(token);table.slots[h]!=KW_NONE;h=(h+1)%KEYWORD_SLOTS){
+        if(KEYWORDS[table.slots[h]].name==token) return table.slots[h];
+    }
+    return KW_NONE;
+}
+
+bool isReservedWord(std::string_view name){
+    return KEYWORDS[lookupKeyword(name)].reserved;
+}
+
+/*
+ * Implementation notes: parseStatement
+ * ------------------------------------
+ * Shared by processLine, which handles one line typed by the user, and
+ * by the loader, which parses whole files.
+ */
+
+Statement *parseStatement(Keyword keyword, TokenScanner &scanner,
+                          Arena &arena, EvalState &state){
+    AllocScope scope(ALLOC_PARSER);
+    StatementFactory factory=KEYWORDS[keyword].factory;
+    if(factory==nullptr) return nullptr;
+    return factory(scanner,arena,state);
+}
+
+/*
+ * Implementation notes: loadStatement
+ * -----------------------------------
+ * The expressions in an image were simplified before they were saved,
+ * so they go straight to newLET and newIF, which pick the fused
+ * classes exactly as they did when the line was parsed.
+ */
+
+Statement *loadStatement(ImageReader &in, Arena &arena){
+    AllocScope scope(ALLOC_PARSER);
+    int slot;
+    switch(in.word()){
+        case KW_NONE: return nullptr;
+        case KW_LET:{
+            std::string name(in.symbol(slot));
+            Expression *exp=in.expression(arena);
+            return newLET(arena,name,slot,exp);
+        }
+        case KW_PRINT: return arena.make<PRINT>(in.expression(arena));
+        case KW_INPUT:{
+            std::string name(in.symbol(slot));
+            return arena.make<INPUT>(name,slot);
+        }
+        case KW_END: return arena.make<END>();
+        case KW_GOTO: return arena.make<GOTO>(int(in.word()));
+        case KW_IF:{
+            Expression *a=in.expression(arena);
+            Expression *b=in.expression(arena);
+            uint32_t cmp=in.word();
+            if(cmp>INVALID_OP) error("BAD IMAGE");
+            int line=int(in.word());
+            return newIF(arena,a,b,Operator(cmp),line);
+        }
+        case KW_REM: return arena.make<REM>();
+        case KW_LIST: return arena.make<LIST>();
+        case KW_CLEAR: return arena.make<CLEAR>();
+        case KW_QUIT: return arena.make<QUIT>();
+        case KW_HELP: return arena.make<HELP>();
+        default:
+            error("BAD IMAGE");
+            return nullptr;
+    }
+}
@@ -21,8 +21,12 @@
 #include "Utils/error.hpp"
 #include "Utils/strlib.hpp"
 #include "program.hpp"
+#include "bytecode.hpp"
+#include "threaded.hpp"
 
 class Program;
+class ImageWriter;
+class ImageReader;
 /*
  * Class: Statement
  * ----------------
@@ -48,11 +52,11 @@ public:
 
 /*
  * Destructor: ~Statement
- * Usage: delete stmt;
- * -------------------
- * The destructor deallocates the storage for this expression.
+ * ----------------------
+ * The destructor deallocates the storage for this statement.
  * It must be declared virtual to ensure that the correct subclass
- * destructor is called when deleting a statement.
+ * destructor is called.  Statements and their expressions are made in
+ * the Arena of their program line and are destroyed with it.
  */
 
     virtual ~Statement();
@@ -76,7 +80,38 @@ public:
 // 子类需要重写 execute() 函数，并根据特定语句的要求实现相应的操作。
 // 每个子类都会定义自己的 execute() 方法来执行特定类型的语句。
 
-    virtual void erase_print(){};
+/*
+ * Method: link
+ * Usage: stmt->link(program);
+ * ---------------------------
+ * Resolves the branch targets of this statement against the line
+ * table of program.  Statements that cannot jump ignore the call.
+ */
+
+    virtual void link(const Program &program);
+
+/*
+ * Method: emitThreaded
+ * Usage: stmt->emitThreaded(out);
+ * -------------------------------
+ * Appends the code for this statement to the whole-program code that
+ * ThreadedCode is building.  Statements with bytecode contribute their
+ * chunk; the default implementation arranges for execute to be called.
+ */
+
+    virtual void emitThreaded(ThreadedCode &out);
+
+/*
+ * Method: save
+ * Usage: stmt->save(out);
+ * -----------------------
+ * Writes the statement to an image (see image.h) as its Keyword and
+ * whatever loadStatement needs to build it again without parsing.  The
+ * default implementation writes KW_NONE, which makes the loader parse
+ * the line's source instead.
+ */
+
+    virtual void save(ImageWriter &out);
 
 };
 
@@ -86,56 +121,173 @@ public:
  * definitions for the individual statement forms.  Each of
  * those subclasses must define a constructor that parses a
  * statement from a scanner and a method called execute,
- * which executes that statement.  If the private data for
- * a subclass includes data allocated on the heap (such as
- * an Expression object), the class implementation must also
- * specify its own destructor method to free that memory.
+ * which executes that statement.  Expression objects referred
+ * to by a statement live in the same Arena as the statement, so
+ * the subclasses do not free them.
+ */
+bool isNumeric(std::string_view str);
+Value readInputNumber(EvalState &state);
+
+/*
+ * Type: Keyword
+ * -------------
+ * The words that begin a statement or a command, as identified by
+ * lookupKeyword.  KW_NONE stands for any other token.
  */
-bool isNumeric(const std::string& str);
+
+enum Keyword {
+    KW_NONE,
+    KW_LET, KW_PRINT, KW_INPUT, KW_END, KW_GOTO, KW_IF, KW_REM,
+    KW_RUN, KW_LIST, KW_CLEAR, KW_QUIT, KW_HELP, KW_LOAD, KW_ALLOCS,
+    KW_CONT, KW_SAVE
+};
+
+/*
+ * Function: lookupKeyword
+ * Usage: Keyword keyword = lookupKeyword(token);
+ * ----------------------------------------------
+ * Returns the keyword spelled by token, or KW_NONE.  Keywords are
+ * upper case only.
+ */
+
+Keyword lookupKeyword(std::string_view token);
+
+/*
+ * Function: isReservedWord
+ * Usage: if (isReservedWord(name)) . . .
+ * --------------------------------------
+ * Returns true if name is a keyword that cannot be assigned to.  LOAD,
+ * ALLOCS, CONT and SAVE were added after the reserved words were fixed
+ * and are ordinary variable names.
+ */
+
+bool isReservedWord(std::string_view name);
+
+/*
+ * Function: parseStatement
+ * Usage: Statement *stmt = parseStatement(keyword, scanner, arena, state);
+ * ------------------------------------------------------------------------
+ * Builds the statement introduced by keyword from the rest of the line
+ * in scanner, allocating it and its expressions in arena.  Returns NULL
+ * if keyword does not introduce a statement; RUN, LOAD, SAVE and the
+ * other commands without a statement class are carried out by Session.  The target line of an
+ * IF is an expression that is evaluated in state while parsing.
+ */
+
+Statement *parseStatement(Keyword keyword, TokenScanner &scanner,
+                          Arena &arena, EvalState &state);
+
+/*
+ * Function: loadStatement
+ * Usage: Statement *stmt = loadStatement(in, arena);
+ * --------------------------------------------------
+ * Builds a statement from what its save method wrote, allocating it
+ * and its expressions in arena, and returns it as parseStatement
+ * would have returned it.  Returns NULL for KW_NONE.
+ */
+
+Statement *loadStatement(ImageReader &in, Arena &arena);
 class REM:public Statement{
     public:
         virtual void execute(EvalState &state,Program &program) override;
+        virtual void emitThreaded(ThreadedCode &out) override;
+        virtual void save(ImageWriter &out) override;
 };
 class LET:public Statement{
     public:
     std::string str;
+    int slot;
+    bool reserved;
     Expression* ex;
-    LET(std::string,Expression*);
+    Chunk code;
+    LET(std::string,int slot,Expression*,bool reserved);
     virtual void execute(EvalState &state,Program &program) override;
-    ~LET();
+    virtual void emitThreaded(ThreadedCode &out) override;
+    virtual void save(ImageWriter &out) override;
 };
 class PRINT:public Statement{
     public:
     Expression* a;
+    Chunk code;
     PRINT(Expression*);
     virtual void execute(EvalState &state,Program &program) override;
-    void erase_print(){delete a;}
+    virtual void emitThreaded(ThreadedCode &out) override;
+    virtual void save(ImageWriter &out) override;
 };
 class INPUT:public Statement{
     public:
     std::string str;
-    INPUT(std::string variable);
+    int slot;
+    Chunk code;
+    INPUT(std::string variable,int slot);
     virtual void execute(EvalState &state,Program &program) override;
+    virtual void emitThreaded(ThreadedCode &out) override;
+    virtual void save(ImageWriter &out) override;
 };
 class END:public Statement{
     public:
+    Chunk code;
+    END();
     virtual void execute(EvalState &state,Program &program) override;
+    virtual void emitThreaded(ThreadedCode &out) override;
+    virtual void save(ImageWriter &out) override;
 };
 class GOTO:public Statement{
     public:
     int value;
+    int target;
+    Chunk code;
     GOTO(int);
     virtual void execute(EvalState &state,Program &program) override;
+    virtual void link(const Program &program) override;
+    virtual void emitThreaded(ThreadedCode &out) override;
+    virtual void save(ImageWriter &out) override;
 };
 class IF:public Statement{
     public:
     Expression* e1;
     Expression* e2;
-    std::string cmp;
+    Operator cmp;
     int line;
-    IF (Expression*, Expression*, std::string, int);
+    int target;
+    bool constantTarget;   // THEN 后是常数：存入映像时不必保留目标表达式
+    Chunk code;
+    IF (Expression*, Expression*, Operator, int);
+    virtual void execute(EvalState &state,Program &program) override;
+    virtual void link(const Program &program) override;
+    virtual void emitThreaded(ThreadedCode &out) override;
+    virtual void save(ImageWriter &out) override;
+};
+
+/*
+ * Classes: LET_ADD, IF_CONST
+ * --------------------------
+ * Fused forms of the two statement shapes that dominate loops: a LET
+ * whose value is a variable plus or minus a constant (LET i = i + 1),
+ * and an IF that compares a variable with a constant (IF i < 100 THEN
+ * 20).  They execute directly on variable slots, without walking an
+ * expression or running a chunk, and report the same errors as the
+ * general statements.  The tree interpreter still uses the general
+ * code, which is kept in the base class.  The constant is stored as an
+ * int, so a statement whose constant is wider is not fused.
+ */
+
+class LET_ADD:public LET{
+    public:
+    int source;
+    int constant;
+    LET_ADD(std::string,int slot,Expression*,int source,int constant);
+    virtual void execute(EvalState &state,Program &program) override;
+    virtual void emitThreaded(ThreadedCode &out) override;
+};
+class IF_CONST:public IF{
+    public:
+    int slot;
+    int constant;
+    bool constantFirst;
+    IF_CONST(Expression*,Expression*,Operator,int);
     virtual void execute(EvalState &state,Program &program) override;
-    virtual ~IF();
+    virtual void emitThreaded(ThreadedCode &out) override;
 };
 class RUN:public Statement{
     public:
@@ -144,18 +296,22 @@ class RUN:public Statement{
 class LIST:public Statement{
     public:
     virtual void execute(EvalState &state,Program &program) override;
+    virtual void save(ImageWriter &out) override;
 };
 class CLEAR:public Statement{
     public:
     virtual void execute(EvalState &state,Program &program) override;
+    virtual void save(ImageWriter &out) override;
 };
 class QUIT:public Statement{
     public:
     virtual void execute(EvalState &state,Program &program) override;
+    virtual void save(ImageWriter &out) override;
 };
 class HELP:public Statement{
     public:
     virtual void execute(EvalState &state,Program &program) override;
+    virtual void save(ImageWriter &out) override;
 };
 
 #endif
@@ -0,0 +1,343 @@
+/*
+ * File: threaded.cpp
+ * ------------------
+ * This file implements the ThreadedCode engine.
+ */
+
+#include <algorithm>
+#include "threaded.hpp"
+#include "jit.hpp"
+#include "program.hpp"
+#include "statement.hpp"
+
+bool useThreaded = true;
+
+/*
+ * Implementation notes: dispatch
+ * ------------------------------
+ * With GCC or Clang every handler ends by jumping through the handler
+ * address of the next instruction (direct threading), which gives each
+ * handler its own indirect branch for the predictor to learn.  Other
+ * compilers, or builds with BASIC_NO_COMPUTED_GOTO defined, use an
+ * ordinary switch in a loop.  The handlers are written once, with
+ * HANDLER and NEXT expanding to the form each strategy needs.
+ */
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(BASIC_NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+#define THREADED_OPS(X) \
+    X(OP_CONST) X(OP_CONST_WIDE) X(OP_LOAD) X(OP_ASSIGN) X(OP_ADD) X(OP_SUB) X(OP_MUL) X(OP_DIV) \
+    X(OP_SHL) X(OP_FAIL) X(OP_LET) X(OP_SYNTAX_ERROR) X(OP_PRINT) X(OP_INPUT) \
+    X(OP_GOTO) X(OP_IF_LT) X(OP_IF_GT) X(OP_IF_EQ) X(OP_END) X(OP_CALL) \
+    X(OP_ADD_CONST) X(OP_IF_CONST_LT) X(OP_IF_CONST_GT) X(OP_IF_CONST_EQ)
+
+static const int INLINE_STACK_SIZE = 64;
+
+/* Implementation of Statement::emitThreaded */
+
+void Statement::emitThreaded(ThreadedCode &code) {
+    code.emitCall(this);
+}
+
+/* Implementation of the ThreadedCode class */
+
+ThreadedCode::ThreadedCode(const Program &program) {
+    maxStack = 0;
+    threaded = false;
+    for (int i = 0; i < program.size(); i++) {
+        lineStart.push_back(int(code.size()));
+        Statement *stmt = program.lineAt(i).stmt;
+        if (stmt != nullptr) stmt->emitThreaded(*this);
+    }
+    lineStart.push_back(int(code.size()));
+    emit(OP_END);
+    for (int pc : jumps) {
+        int line = code[pc].c;
+        jumpLines.push_back(line);
+        code[pc].c = (line < 0) ? -1 : lineStart[line];
+    }
+    if (useJit && !useInt64 && JitCode::supported()) jit.reset(new JitCode(code));
+}
+
+ThreadedCode::~ThreadedCode() {}
+
+/*
+ * Implementation notes: lineAt, jumpTarget
+ * ----------------------------------------
+ * lineAt returns the index of the line whose code contains position.
+ * Lines without code, such as REM, start where the next line does, so
+ * the line that owns an instruction is the last of those with its
+ * start.  A suspended jump cannot be named that way, since it may have
+ * gone to one of the lines without code, as the tree engine reports;
+ * jumpTarget looks up the line the jump at position was emitted with.
+ * Jumps are recorded in code order, so the lookup is a binary search.
+ */
+
+int ThreadedCode::lineAt(int position) const {
+    auto last = lineStart.end() - 1;
+    auto it = std::upper_bound(lineStart.begin(), last, position);
+    return int(it - lineStart.begin()) - 1;
+}
+
+int ThreadedCode::jumpTarget(int position) const {
+    auto it = std::lower_bound(jumps.begin(), jumps.end(), position);
+    return jumpLines[it - jumps.begin()];
+}
+
+void ThreadedCode::emit(OpCode op, int a, int b, int c) {
+    code.push_back({nullptr, op, a, b, c});
+}
+
+void ThreadedCode::emitJump(OpCode op, int a, int b, int lineIndex) {
+    jumps.push_back(int(code.size()));
+    emit(op, a, b, lineIndex);
+}
+
+void ThreadedCode::emitCall(Statement *stmt) {
+    calls.push_back(stmt);
+    emit(OP_CALL, int(calls.size()) - 1);
+}
+
+/*
+ * Implementation notes: emitChunk
+ * -------------------------------
+ * Most instructions are copied with their operand in a.  The end of the
+ * chunk simply falls through into the next line, messages are copied
+ * into the engine's own table, wide constants are split into their low
+ * and high halves in a and b, and branch targets, which link resolved
+ * to line positions, become jumps.
+ */
+
+void ThreadedCode::emitChunk(const Chunk &chunk) {
+    maxStack = std::max(maxStack, chunk.maxStack);
+    for (const Instruction &in : chunk.code) {
+        switch (in.op) {
+            case OP_RETURN:
+                break;
+            case OP_FAIL:
+                messages.push_back(chunk.messages[in.operand]);
+                emit(OP_FAIL, int(messages.size()) - 1);
+                break;
+            case OP_CONST_WIDE: {
+                uint64_t value = uint64_t(chunk.constants[in.operand]);
+                emit(OP_CONST_WIDE, int(uint32_t(value)), int(uint32_t(value >> 32)));
+                break;
+            }
+            case OP_GOTO: case OP_IF_LT: case OP_IF_GT: case OP_IF_EQ:
+                emitJump(in.op, 0, 0, chunk.targets[in.operand].index);
+                break;
+            default:
+                emit(in.op, in.operand);
+                break;
+        }
+    }
+}
+
+/*
+ * Implementation notes: run
+ * -------------------------
+ * OP_CALL runs a statement through its execute method, so it is the
+ * only place where the Program side channel still matters: a statement
+ * could in principle request a jump or a stop, and CLEAR edits the
+ * program, which makes this code stale and ends the run.
+ *
+ * Every taken jump goes through JUMP, which charges backward jumps to
+ * the budget and then hands them to the JIT.  When native code runs, it
+ * returns the position to continue at and leaves the operand stack in
+ * stack, as if the instructions in between had been interpreted.  The
+ * native code counts down the same budget; if it used up the current
+ * stretch, it stopped at the target of a backward jump, so the run can
+ * be suspended there.  Jumps only go to the start of a line, where the
+ * operand stack is empty, so suspending needs nothing but the line.
+ */
+
+void ThreadedCode::run(EvalState &state, Program &program, int index) {
+#if USE_COMPUTED_GOTO
+    if (!threaded) {
+        for (ThreadedInstruction &in : code) {
+            switch (in.op) {
+#define LABEL(op) case op: in.handler = &&L_##op; break;
+                THREADED_OPS(LABEL)
+#undef LABEL
+                default: in.handler = &&L_OP_END; break;
+            }
+        }
+        threaded = true;
+    }
+#define HANDLER(op) L_##op
+#define NEXT() do { in = ip++; goto *in->handler; } while (0)
+#else
+#define HANDLER(op) case op
+#define NEXT() goto dispatch
+#endif
+#define JUMP() do { \
+        if (in->c < 0) error("LINE NUMBER ERROR"); \
+        ip = base + in->c; \
+        if (ip <= in) goto backedge; \
+    } while (0)
+
+    Value inlineStack[INLINE_STACK_SIZE];
+    std::vector<Value> heapStack;
+    Value *stack = inlineStack;
+    if (maxStack > INLINE_STACK_SIZE) {
+        heapStack.resize(maxStack);
+        stack = heapStack.data();
+    }
+    int sp = 0;
+    const ThreadedInstruction *base = code.data();
+    const ThreadedInstruction *ip = base + lineStart[index];
+    const ThreadedInstruction *in;
+
+#if USE_COMPUTED_GOTO
+    NEXT();
+#else
+dispatch:
+    in = ip++;
+    switch (in->op) {
+#endif
+
+    HANDLER(OP_CONST):
+        stack[sp++] = in->a;
+        NEXT();
+    HANDLER(OP_CONST_WIDE):
+        stack[sp++] = Value(uint64_t(uint32_t(in->a)) | uint64_t(uint32_t(in->b)) << 32);
+        NEXT();
+    HANDLER(OP_LOAD):
+        if (!state.isDefined(in->a)) error("VARIABLE NOT DEFINED");
+        stack[sp++] = state.getValue(in->a);
+        NEXT();
+    HANDLER(OP_ASSIGN):
+        state.setValue(in->a, stack[sp - 1]);
+        NEXT();
+    HANDLER(OP_ADD):
+        sp--;
+        stack[sp - 1] = addValues(stack[sp - 1], stack[sp]);
+        NEXT();
+    HANDLER(OP_SUB):
+        sp--;
+        stack[sp - 1] = subValues(stack[sp - 1], stack[sp]);
+        NEXT();
+    HANDLER(OP_MUL):
+        sp--;
+        stack[sp - 1] = mulValues(stack[sp - 1], stack[sp]);
+        NEXT();
+    HANDLER(OP_DIV):
+        sp--;
+        stack[sp - 1] = divValues(stack[sp - 1], stack[sp]);
+        NEXT();
+    HANDLER(OP_SHL):
+        stack[sp - 1] = shlValue(stack[sp - 1], in->a);
+        NEXT();
+    HANDLER(OP_FAIL):
+        error(messages[in->a]);
+        NEXT();
+    HANDLER(OP_LET):
+        state.setValue(in->a, stack[--sp]);
+        NEXT();
+    HANDLER(OP_SYNTAX_ERROR):
+        sp--;
+        state.output() << "SYNTAX ERROR\n";
+        NEXT();
+    HANDLER(OP_PRINT):
+        state.output() << stack[--sp] << '\n';
+        NEXT();
+    HANDLER(OP_INPUT): {
+        Value value = readInputNumber(state);
+        if (state.waitingForInput()) {
+            program.suspend(lineAt(int(in - base)));
+            return;
+        }
+        state.setValue(in->a, value);
+        NEXT();
+    }
+    HANDLER(OP_GOTO):
+        JUMP();
+        NEXT();
+    HANDLER(OP_IF_LT):
+        sp -= 2;
+        if (stack[sp] < stack[sp + 1]) {
+            JUMP();
+        }
+        NEXT();
+    HANDLER(OP_IF_GT):
+        sp -= 2;
+        if (stack[sp] > stack[sp + 1]) {
+            JUMP();
+        }
+        NEXT();
+    HANDLER(OP_IF_EQ):
+        sp -= 2;
+        if (stack[sp] == stack[sp + 1]) {
+            JUMP();
+        }
+        NEXT();
+    HANDLER(OP_ADD_CONST):
+        if (!state.isDefined(in->b)) error("VARIABLE NOT DEFINED");
+        state.setValue(in->a, addValues(state.getValue(in->b), in->c));
+        NEXT();
+    HANDLER(OP_IF_CONST_LT):
+        if (!state.isDefined(in->a)) error("VARIABLE NOT DEFINED");
+        if (state.getValue(in->a) < in->b) {
+            JUMP();
+        }
+        NEXT();
+    HANDLER(OP_IF_CONST_GT):
+        if (!state.isDefined(in->a)) error("VARIABLE NOT DEFINED");
+        if (state.getValue(in->a) > in->b) {
+            JUMP();
+        }
+        NEXT();
+    HANDLER(OP_IF_CONST_EQ):
+        if (!state.isDefined(in->a)) error("VARIABLE NOT DEFINED");
+        if (state.getValue(in->a) == in->b) {
+            JUMP();
+        }
+        NEXT();
+    HANDLER(OP_CALL):
+        calls[in->a]->execute(state, program);
+        if (!program.isLinked()) return;
+        if (program.whether_stop) {
+            program.whether_stop = false;
+            return;
+        }
+        if (program.jump_index >= 0) {
+            ip = base + lineStart[program.jump_index];
+            program.jump_index = -1;
+        }
+        NEXT();
+    HANDLER(OP_END):
+        return;
+
+backedge:
+    if (program.backEdge()) {
+        program.suspend(jumpTarget(int(in - base)));
+        return;
+    }
+    if (jit) {
+        int jump = int(in - base);
+        int pc = jit->enter(int(ip - base), jump, state, stack, sp,
+                            program.backEdgeCountdown(), jump);
+        if (pc >= 0) {
+            ip = base + pc;
+            if (program.backEdgeCountdown() == 0 && program.sliceExpired()) {
+                program.suspend(jumpTarget(jump));
+                return;
+            }
+        }
+    }
+    NEXT();
+
+#if !USE_COMPUTED_GOTO
+        default:
+            return;
+    }
+#endif
+
+#undef HANDLER
+#undef NEXT
+#undef JUMP
+}
@@ -0,0 +1,124 @@
+/*
+ * File: threaded.h
+ * ----------------
+ * This interface exports ThreadedCode, an execution engine that runs a
+ * whole program as one array of instructions instead of one statement
+ * at a time.
+ */
+
+#ifndef _threaded_h
+#define _threaded_h
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "bytecode.hpp"
+
+class JitCode;
+class Program;
+class Statement;
+
+/*
+ * Type: ThreadedInstruction
+ * -------------------------
+ * One instruction of the whole-program code.  handler is the address
+ * of the code that implements op when the engine is built with GCC's
+ * labels-as-values extension; a, b and c are the operands.  For every
+ * jump, c is the position of the target instruction, or -1 if the
+ * target line does not exist.
+ */
+
+struct ThreadedInstruction {
+    const void *handler;
+    OpCode op;
+    int a, b, c;
+};
+
+/*
+ * Class: ThreadedCode
+ * -------------------
+ * The code of all lines of a linked program laid out back to back, so
+ * that falling through from one line to the next needs no instruction
+ * at all, and GOTO and IF jump straight to the first instruction of
+ * their target line.  Control flow never goes through the jump_index
+ * and whether_stop fields of Program, and dispatch goes directly from
+ * each handler to the next one.  A program must be recompiled after it
+ * has been edited; Program::run takes care of that.
+ */
+
+class ThreadedCode {
+
+public:
+
+/*
+ * Constructor: ThreadedCode
+ * Usage: ThreadedCode code(program);
+ * ----------------------------------
+ * Compiles program, which must be linked.
+ */
+
+    explicit ThreadedCode(const Program &program);
+
+    ~ThreadedCode();
+
+/*
+ * Method: run
+ * Usage: code.run(state, program, index);
+ * ---------------------------------------
+ * Executes the program from the line at position index in the line
+ * table until it runs off the end or executes END.  program is the
+ * program the code was compiled from; statements without bytecode are
+ * executed against it.  A statement that edits the program (CLEAR)
+ * ends the run.  Every backward jump is charged to the program's
+ * budget, and the run is suspended when that runs out.  Loops that
+ * become hot are handed to JitCode unless it is disabled.
+ */
+
+    void run(EvalState &state, Program &program, int index = 0);
+
+/*
+ * Methods: emit, emitChunk, emitCall, emitJump
+ * --------------------------------------------
+ * Used by Statement::emitThreaded to append its code.  emitChunk
+ * translates the bytecode of a statement, emitCall arranges for the
+ * statement itself to be executed, and emitJump appends a jump whose
+ * target is given as a position in the line table (or -1).
+ */
+
+    void emit(OpCode op, int a = 0, int b = 0, int c = 0);
+
+    void emitChunk(const Chunk &chunk);
+
+    void emitCall(Statement *stmt);
+
+    void emitJump(OpCode op, int a, int b, int lineIndex);
+
+private:
+
+    int lineAt(int position) const;
+
+    int jumpTarget(int position) const;
+
+    std::vector<ThreadedInstruction> code;
+    std::vector<Statement *> calls;         /* Operands of OP_CALL      */
+    std::vector<std::string> messages;      /* Operands of OP_FAIL      */
+    std::vector<int> lineStart;             /* First instruction of line */
+    std::vector<int> jumps;                 /* Instructions to patch    */
+    std::vector<int> jumpLines;             /* Target line of each jump */
+    int maxStack;
+    bool threaded;                          /* Handlers filled in       */
+    std::unique_ptr<JitCode> jit;           /* Native code, if enabled  */
+
+};
+
+/*
+ * Variable: useThreaded
+ * ---------------------
+ * Selects ThreadedCode (true, the default) or the statement-at-a-time
+ * loop for running programs with the bytecode interpreter.  Cleared by
+ * the --no-threaded command-line option.
+ */
+
+extern bool useThreaded;
+
+#endif
@@ -0,0 +1,10 @@
+/*
+ * File: value.cpp
+ * ---------------
+ * This file defines the arithmetic mode declared in value.h.  The
+ * operators themselves are inline.
+ */
+
+#include "value.hpp"
+
+bool useInt64 = false;
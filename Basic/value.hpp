@@ -0,0 +1,105 @@
+/*
+ * File: value.h
+ * -------------
+ * This interface exports the type of BASIC values and the arithmetic
+ * operators on them.
+ */
+
+#ifndef _value_h
+#define _value_h
+
+#include <climits>
+#include <cstdint>
+#include "Utils/error.hpp"
+
+/*
+ * Type: Value
+ * -----------
+ * The value of a BASIC expression or variable.  Values are always
+ * stored in 64 bits.  In the default mode every result is reduced to
+ * 32 bits, wrapping around on overflow the way the original interpreter
+ * did; with useInt64 set, values use all 64 bits and overflow is an
+ * error.
+ */
+
+typedef int64_t Value;
+
+/*
+ * Variable: useInt64
+ * ------------------
+ * Selects checked 64-bit arithmetic (true) or wrapping 32-bit
+ * arithmetic (false, the default).  Set by the --int64 command-line
+ * option.  The mode must not change once a program has been parsed,
+ * because constants are folded and statements fused under it.
+ */
+
+extern bool useInt64;
+
+/*
+ * Function: fitsInt
+ * Usage: if (fitsInt(value)) . . .
+ * --------------------------------
+ * Returns true if value can be represented as an int.
+ */
+
+inline bool fitsInt(Value value) {
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+/*
+ * Functions: addValues, subValues, mulValues, divValues, shlValue
+ * Usage: Value result = addValues(left, right);
+ * ---------------------------------------------
+ * Apply an arithmetic operator in the current mode.  In 32-bit mode the
+ * operation is done on unsigned values, which wrap around without
+ * undefined behavior, and the result is converted back.  In 64-bit
+ * mode an overflow raises INTEGER OVERFLOW.  divValues reports
+ * DIVIDE BY ZERO itself.
+ */
+
+inline Value addValues(Value left, Value right) {
+    if (useInt64) {
+        Value result;
+        if (__builtin_add_overflow(left, right, &result)) error("INTEGER OVERFLOW");
+        return result;
+    }
+    return int32_t(uint32_t(left) + uint32_t(right));
+}
+
+inline Value subValues(Value left, Value right) {
+    if (useInt64) {
+        Value result;
+        if (__builtin_sub_overflow(left, right, &result)) error("INTEGER OVERFLOW");
+        return result;
+    }
+    return int32_t(uint32_t(left) - uint32_t(right));
+}
+
+inline Value mulValues(Value left, Value right) {
+    if (useInt64) {
+        Value result;
+        if (__builtin_mul_overflow(left, right, &result)) error("INTEGER OVERFLOW");
+        return result;
+    }
+    return int32_t(uint32_t(left) * uint32_t(right));
+}
+
+inline Value divValues(Value left, Value right) {
+    if (right == 0) error("DIVIDE BY ZERO");
+    if (useInt64) {
+        if (left == INT64_MIN && right == -1) error("INTEGER OVERFLOW");
+        return left / right;
+    }
+    return int32_t(uint32_t(left / right));
+}
+
+inline Value shlValue(Value value, int shift) {
+    if (useInt64) {
+        Value result;
+        if (__builtin_mul_overflow(value, Value(1) << shift, &result)) error("INTEGER OVERFLOW");
+        return result;
+    }
+    return int32_t(uint32_t(value) << shift);
+}
+
+#endif
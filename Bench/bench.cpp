@@ -0,0 +1,553 @@
+/*
+ * File: bench.cpp
+ * ---------------
+ * Microbenchmarks for the interpreter.  Each benchmark runs one part of
+ * the interpreter in isolation (the scanner, the parser, the evaluator,
+ * the variable table) or runs a whole synthetic program, and writes one
+ * line of JSON to standard output:
+ *
+ *   {"name":"scanner/nextToken","ops":1800000,"ns_per_op":21.503,
+ *    "allocs_per_op":1.0000}
+ *
+ * ops is the number of operations timed; what an operation is depends
+ * on the benchmark and is given in the comment that defines it.
+ * Allocations are counted by replacing the global operator new, so they
+ * include everything the standard library allocates.  Program
+ * benchmarks also report the final value of one variable as "result".
+ *
+ * Usage: bench [FILTER]
+ * ---------------------
+ * Runs the benchmarks whose names contain FILTER, or all of them.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include "allocstats.hpp"
+#include "arena.hpp"
+#include "bytecode.hpp"
+#include "evalstate.hpp"
+#include "exp.hpp"
+#include "image.hpp"
+#include "jit.hpp"
+#include "loader.hpp"
+#include "parser.hpp"
+#include "program.hpp"
+#include "threaded.hpp"
+#include "value.hpp"
+#include "Utils/tokenScanner.hpp"
+
+/*
+ * Implementation notes: allocation counting
+ * -----------------------------------------
+ * The loader parses on several threads, so the counter is atomic.  The
+ * array and sized forms of new and delete call these by default.  In a
+ * build with BASIC_COUNT_ALLOCATIONS the interpreter library already
+ * replaces operator new, so its total is used instead.
+ */
+
+#ifdef BASIC_COUNT_ALLOCATIONS
+
+static long long allocationTotal() {
+    return allocationCounts(ALLOC_SUBSYSTEMS).allocations;
+}
+
+#else
+
+static std::atomic<long long> allocationCount(0);
+
+void *operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+static long long allocationTotal() {
+    return allocationCount.load();
+}
+
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+/* Results are accumulated here so that the compiler cannot drop the work. */
+
+static volatile Value sink;
+
+/*
+ * Function: clobber
+ * Usage: clobber(object);
+ * -----------------------
+ * Tells the compiler that object may have changed, so that reads from
+ * it are not hoisted out of a timed loop.
+ */
+
+template <typename T>
+static void clobber(T &object) {
+    asm volatile("" : : "r"(&object) : "memory");
+}
+
+static std::string filter;
+
+static bool selected(const std::string &name) {
+    return name.find(filter) != std::string::npos;
+}
+
+/*
+ * Type: Measurement
+ * -----------------
+ * The cost of one timed run: the number of operations it performed,
+ * the time it took and the allocations it made.
+ */
+
+struct Measurement {
+    long long ops;
+    double ns;
+    long long allocations;
+};
+
+/*
+ * Implementation notes: time, report, measure
+ * -------------------------------------------
+ * time makes one call of body, which does the work and returns the
+ * number of operations it performed.  report writes the JSON line;
+ * extra, if not empty, is appended to the object and must start with a
+ * comma.  measure does both for a selected benchmark.
+ */
+
+template <typename Body>
+static Measurement time(Body body) {
+    long long allocationsBefore = allocationTotal();
+    Clock::time_point start = Clock::now();
+    long long ops = body();
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    return {ops > 0 ? ops : 1, ns, allocationTotal() - allocationsBefore};
+}
+
+static void report(const std::string &name, const Measurement &m, const std::string &extra = "") {
+    std::printf("{\"name\":\"%s\",\"ops\":%lld,\"ns_per_op\":%.3f,\"allocs_per_op\":%.4f%s}\n",
+                name.c_str(), m.ops, m.ns / double(m.ops),
+                double(m.allocations) / double(m.ops), extra.c_str());
+    std::fflush(stdout);
+}
+
+template <typename Body>
+static void measure(const std::string &name, Body body) {
+    if (selected(name)) report(name, time(body));
+}
+
+static const char *const SAMPLE_LINES[] = {
+    "100 LET total = (alpha + 12) * beta - gamma / 3",
+    "110 IF counter < 1000 THEN 100",
+    "120 PRINT total * 2 + offset",
+    "130 GOTO 110",
+};
+
+static const char *const SAMPLE_EXPRESSIONS[] = {
+    "(alpha + 12) * beta - gamma / 3",
+    "total * 2 + offset",
+    "a + b * (c - d) / (e + 1)",
+    "x = y = z + 1",
+};
+
+/*
+ * Benchmarks: scanner/nextToken, scanner/nextTokenView
+ * ----------------------------------------------------
+ * One operation is one token read from a typical program line, as a
+ * string and as a view of the line.
+ */
+
+template <typename Read>
+static long long scanSampleLines(int rounds, Read read) {
+    long long tokens = 0;
+    TokenScanner scanner;
+    scanner.ignoreWhitespace();
+    scanner.scanNumbers();
+    for (int round = 0; round < rounds; round++) {
+        for (const char *line : SAMPLE_LINES) {
+            scanner.setInputView(line);
+            while (scanner.hasMoreTokens()) {
+                sink = Value(read(scanner));
+                tokens++;
+            }
+        }
+    }
+    return tokens;
+}
+
+static void benchScanner() {
+    const int rounds = 100000;
+    measure("scanner/nextToken", [&] {
+        return scanSampleLines(rounds, [](TokenScanner &scanner) {
+            return scanner.nextToken().size();
+        });
+    });
+    measure("scanner/nextTokenView", [&] {
+        return scanSampleLines(rounds, [](TokenScanner &scanner) {
+            return scanner.nextTokenView().text.size();
+        });
+    });
+}
+
+/*
+ * Benchmark: parser/parseExp
+ * --------------------------
+ * One operation is parsing one expression into a tree, with the arena
+ * reset after each one as the interpreter does for immediate commands.
+ */
+
+static void benchParser() {
+    const int rounds = 50000;
+    measure("parser/parseExp", [&] {
+        long long lines = 0;
+        TokenScanner scanner;
+        scanner.ignoreWhitespace();
+        scanner.scanNumbers();
+        Arena arena;
+        Symbols symbols;
+        for (int round = 0; round < rounds; round++) {
+            for (const char *text : SAMPLE_EXPRESSIONS) {
+                scanner.setInputView(text);
+                sink = parseExp(scanner, arena, symbols)->getType();
+                arena.reset();
+                lines++;
+            }
+        }
+        return lines;
+    });
+}
+
+/*
+ * Implementation notes: balancedExpression
+ * ----------------------------------------
+ * Returns the text of a full binary tree of the given depth over the
+ * variables a to h, using the arithmetic operators other than division.
+ * It has 2^(depth+1) - 1 nodes.
+ */
+
+static std::string balancedExpression(int depth, int &leaf) {
+    if (depth == 0) return std::string(1, char('a' + leaf++ % 8));
+    static const char OPERATORS[] = { '+', '-', '*', '+' };
+    std::string lhs = balancedExpression(depth - 1, leaf);
+    std::string rhs = balancedExpression(depth - 1, leaf);
+    return "(" + lhs + " " + OPERATORS[depth % 4] + " " + rhs + ")";
+}
+
+/*
+ * Benchmarks: eval/tree, eval/bytecode
+ * ------------------------------------
+ * One operation is evaluating one node of a 63-node expression, by
+ * walking the tree and by running its compiled chunk.
+ */
+
+static void benchEval() {
+    const int depth = 5;
+    const int nodes = (1 << (depth + 1)) - 1;
+    const int rounds = 200000;
+    int leaf = 0;
+    std::string text = balancedExpression(depth, leaf);
+    TokenScanner scanner;
+    scanner.ignoreWhitespace();
+    scanner.scanNumbers();
+    scanner.setInputView(text);
+    Arena arena;
+    EvalState state;
+    Expression *exp = parseExp(scanner, arena, state.symbols());
+    for (char name = 'a'; name <= 'h'; name++) state.setValue(std::string(1, name), name - 'a' + 1);
+    measure("eval/tree", [&] {
+        Value total = 0;
+        for (int round = 0; round < rounds; round++) total += exp->eval(state);
+        sink = total;
+        return (long long) rounds * nodes;
+    });
+    Chunk chunk;
+    compileExp(exp, chunk);
+    chunk.emit(OP_RETURN);
+    Program program;
+    measure("eval/bytecode", [&] {
+        for (int round = 0; round < rounds; round++) runChunk(chunk, state, program);
+        return (long long) rounds * nodes;
+    });
+}
+
+/*
+ * Benchmarks: evalstate/METHOD/slot, evalstate/METHOD/name
+ * --------------------------------------------------------
+ * One operation is one access to one of 64 variables, either by the
+ * slot the parser resolves names to or by name.
+ */
+
+static void benchEvalState() {
+    const int variables = 64;
+    const int rounds = 100000;
+    const int namedRounds = rounds / 10;
+    std::vector<std::string> names;
+    std::vector<int> slots;
+    EvalState state;
+    for (int i = 0; i < variables; i++) {
+        names.push_back("v" + std::to_string(i));
+        slots.push_back(state.symbols().intern(names.back()));
+    }
+    measure("evalstate/setValue/slot", [&] {
+        for (int round = 0; round < rounds; round++) {
+            for (int i = 0; i < variables; i++) state.setValue(slots[i], round + i);
+        }
+        return (long long) rounds * variables;
+    });
+    measure("evalstate/getValue/slot", [&] {
+        Value total = 0;
+        for (int round = 0; round < rounds; round++) {
+            clobber(state);
+            for (int i = 0; i < variables; i++) total += state.getValue(slots[i]);
+        }
+        sink = total;
+        return (long long) rounds * variables;
+    });
+    measure("evalstate/isDefined/slot", [&] {
+        Value total = 0;
+        for (int round = 0; round < rounds; round++) {
+            clobber(state);
+            for (int i = 0; i < variables; i++) total += state.isDefined(slots[i]);
+        }
+        sink = total;
+        return (long long) rounds * variables;
+    });
+    measure("evalstate/setValue/name", [&] {
+        for (int round = 0; round < namedRounds; round++) {
+            for (int i = 0; i < variables; i++) state.setValue(names[i], round + i);
+        }
+        return (long long) namedRounds * variables;
+    });
+    measure("evalstate/getValue/name", [&] {
+        Value total = 0;
+        for (int round = 0; round < namedRounds; round++) {
+            for (int i = 0; i < variables; i++) total += state.getValue(names[i]);
+        }
+        sink = total;
+        return (long long) namedRounds * variables;
+    });
+}
+
+/*
+ * Benchmarks: arith/OP/MODE
+ * -------------------------
+ * One operation is one application of an arithmetic operator in the
+ * wrapping 32-bit mode or the checked 64-bit mode.  The operands are
+ * small enough that no result overflows, so that both modes take their
+ * normal path.
+ */
+
+template <typename Op>
+static void benchOperator(const std::string &name, Op op) {
+    const int rounds = 2000;
+    std::vector<Value> operands;
+    for (int i = 0; i < 4096; i++) operands.push_back(i % 1000 + 1);
+    for (bool int64 : {false, true}) {
+        useInt64 = int64;
+        measure("arith/" + name + (int64 ? "/int64" : "/int32"), [&] {
+            Value total = 0;
+            for (int round = 0; round < rounds; round++) {
+                for (int i = 1; i < int(operands.size()); i++) {
+                    total ^= op(operands[i - 1], operands[i]);
+                }
+            }
+            sink = total;
+            return (long long) rounds * (operands.size() - 1);
+        });
+    }
+    useInt64 = false;
+}
+
+static void benchArithmetic() {
+    benchOperator("add", [](Value a, Value b) { return addValues(a, b); });
+    benchOperator("sub", [](Value a, Value b) { return subValues(a, b); });
+    benchOperator("mul", [](Value a, Value b) { return mulValues(a, b); });
+    benchOperator("div", [](Value a, Value b) { return divValues(a, b); });
+}
+
+/*
+ * Implementation notes: runProgram
+ * --------------------------------
+ * Loads a synthetic program and runs it once with each engine, and
+ * with both arithmetic modes if bothModes is set; the JIT only exists
+ * in 32-bit mode.  The engine and the mode are globals, so they are set
+ * before the program is parsed and reset to the defaults afterwards.
+ * Only the run is timed, and ops is the number of operations it counts
+ * as.
+ */
+
+struct Engine {
+    const char *name;
+    bool bytecode, threaded, jit;
+};
+
+static const Engine ENGINES[] = {
+    {"tree", false, false, false},
+    {"bytecode", true, false, false},
+    {"threaded", true, true, false},
+    {"jit", true, true, true},
+};
+
+static void selectEngine(const Engine &engine, bool int64) {
+    useBytecode = engine.bytecode;
+    useThreaded = engine.threaded;
+    useJit = engine.jit;
+    useInt64 = int64;
+}
+
+static void runProgram(const std::string &name, const std::string &text, long long ops,
+                       const std::string &result, bool bothModes = false) {
+    for (const Engine &engine : ENGINES) {
+        for (bool int64 : {false, true}) {
+            if (int64 && (!bothModes || engine.jit)) continue;
+            std::string fullName = name + "/" + engine.name;
+            if (bothModes) fullName += int64 ? "/int64" : "/int32";
+            if (!selected(fullName)) continue;
+            selectEngine(engine, int64);
+            Program program;
+            EvalState state;
+            loadProgramText(text, program, state);
+            Measurement m = time([&] {
+                program.run(state);
+                return ops;
+            });
+            report(fullName, m, ",\"result\":" + std::to_string(state.getValue(result)));
+        }
+    }
+    selectEngine(ENGINES[3], false);
+}
+
+/*
+ * Benchmark: count/ENGINE/MODE
+ * ----------------------------
+ * One operation is one trip round a loop that adds up the first
+ * 3000000 integers.  The sum passes 2^31 early on, so the result shows
+ * the 32-bit sum wrapping around and the 64-bit sum staying exact.
+ */
+
+static std::string countingLoop(int count) {
+    return "10 LET i = 0\n20 LET s = 0\n30 LET s = s + i\n40 LET i = i + 1\n"
+           "50 IF i < " + std::to_string(count) + " THEN 30\n";
+}
+
+/*
+ * Benchmark: run/goto-loop/ENGINE
+ * -------------------------------
+ * One operation is one trip round a loop of LET, IF and GOTO.
+ */
+
+static std::string gotoLoop(int count) {
+    return "10 LET i = 0\n20 LET i = i + 1\n30 IF i > " + std::to_string(count) + " THEN 50\n"
+           "40 GOTO 20\n50 END\n";
+}
+
+/*
+ * Benchmark: run/deep-expression/ENGINE
+ * -------------------------------------
+ * One operation is one trip round a loop that evaluates a 31-node
+ * expression.
+ */
+
+static std::string deepExpressionLoop(int count) {
+    int leaf = 0;
+    return "5 LET a = 1\n6 LET b = 2\n7 LET c = 3\n8 LET d = 4\n"
+           "9 LET e = 5\n10 LET f = 6\n11 LET g = 7\n12 LET h = 8\n"
+           "13 LET i = 0\n20 LET x = " + balancedExpression(4, leaf) + "\n"
+           "30 LET i = i + 1\n40 IF i < " + std::to_string(count) + " THEN 20\n";
+}
+
+/*
+ * Benchmark: run/many-variables/ENGINE
+ * ------------------------------------
+ * One operation is one LET in a loop that assigns each of 1000
+ * variables from the one before.
+ */
+
+static std::string manyVariablesLoop(int variables, int count) {
+    std::string text = "10 LET i = 0\n20 LET v0 = i\n";
+    for (int k = 1; k < variables; k++) {
+        text += std::to_string(20 + k) + " LET v" + std::to_string(k) + " = v"
+              + std::to_string(k - 1) + " + 1\n";
+    }
+    int next = 20 + variables;
+    text += std::to_string(next) + " LET i = i + 1\n";
+    text += std::to_string(next + 1) + " IF i < " + std::to_string(count) + " THEN 20\n";
+    return text;
+}
+
+/*
+ * Benchmarks: load/100k-lines, load/100k-lines/image,
+ *             run/100k-lines/ENGINE
+ * ---------------------------------------------------
+ * One operation is loading or running one line of a straight-line
+ * program of 100000 LETs.  The image load starts from an image that
+ * is already in memory, so it leaves out the file system as the text
+ * load does.  The run includes whatever the engine prepares before the
+ * first line executes.
+ */
+
+static std::string straightLine(int lines) {
+    std::string text = "1 LET x = 0\n";
+    for (int k = 1; k < lines; k++) {
+        text += std::to_string(k + 1) + " LET x = x + " + std::to_string(k % 7) + "\n";
+    }
+    return text;
+}
+
+static void benchPrograms() {
+    const int count = 3000000;
+    runProgram("count", countingLoop(count), count, "s", true);
+    runProgram("run/goto-loop", gotoLoop(1000000), 1000000, "i");
+    runProgram("run/deep-expression", deepExpressionLoop(200000), 200000, "x");
+    runProgram("run/many-variables", manyVariablesLoop(1000, 200), 1000 * 200, "v999");
+    const int lines = 100000;
+    std::string text = straightLine(lines);
+    measure("load/100k-lines", [&] {
+        Program program;
+        EvalState state;
+        loadProgramText(text, program, state);
+        return (long long) lines;
+    });
+    std::string image;
+    {
+        Program program;
+        EvalState state;
+        loadProgramText(text, program, state);
+        image = buildImage(program);
+    }
+    measure("load/100k-lines/image", [&] {
+        Program program;
+        EvalState state;
+        loadImageData(image, program, state);
+        return (long long) lines;
+    });
+    runProgram("run/100k-lines", text, lines, "x");
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        std::fprintf(stderr, "usage: %s [FILTER]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) filter = argv[1];
+    benchScanner();
+    benchParser();
+    benchEval();
+    benchEvalState();
+    benchArithmetic();
+    benchPrograms();
+    return 0;
+}
@@ -0,0 +1,7 @@
+10 LET N = 10
+20 LET S = 0
+30 LET S = S + N * N
+40 LET N = N - 1
+50 IF N > 0 THEN 30
+60 PRINT S
+70 END
@@ -0,0 +1,32 @@
+# Runs one trace through the interpreter and compares its output with
+# the expected output.
+#
+#   BASIC     the interpreter
+#   TRACE     the input, fed to the interpreter on stdin
+#   EXPECTED  what the interpreter must write to stdout
+#   OPTIONS   command-line options, separated by |
+#   FILES     files the trace uses, separated by |, copied into WORKDIR
+#   WORKDIR   a scratch directory, emptied first, to run the trace in
+
+file(REMOVE_RECURSE "${WORKDIR}")
+file(MAKE_DIRECTORY "${WORKDIR}")
+if(FILES)
+    string(REPLACE "|" ";" FILES "${FILES}")
+    file(COPY ${FILES} DESTINATION "${WORKDIR}")
+endif()
+string(REPLACE "|" ";" OPTIONS "${OPTIONS}")
+
+execute_process(COMMAND "${BASIC}" ${OPTIONS}
+        INPUT_FILE "${TRACE}"
+        OUTPUT_VARIABLE output
+        RESULT_VARIABLE result
+        WORKING_DIRECTORY "${WORKDIR}"
+        TIMEOUT 60)
+file(READ "${EXPECTED}" expected)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${BASIC} exited with ${result}")
+endif()
+if(NOT output STREQUAL expected)
+    file(WRITE "${WORKDIR}/actual.out" "${output}")
+    message(FATAL_ERROR "Output differs from ${EXPECTED}; see ${WORKDIR}/actual.out")
+endif()
@@ -0,0 +1,63 @@
+/*
+ * File: execution_test.cpp
+ * ------------------------
+ * Checks that an Execution can be run, suspended at an INPUT with no
+ * line queued, given its input and then advanced in slices of backward
+ * jumps until the program ends.  Exits with a nonzero status and a
+ * message on the first check that fails.
+ */
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include "evalstate.hpp"
+#include "execution.hpp"
+#include "loader.hpp"
+#include "program.hpp"
+
+static const char *PROGRAM =
+    "10 INPUT X\n"
+    "20 LET S = 0\n"
+    "30 LET I = 0\n"
+    "40 LET I = I + 1\n"
+    "50 LET S = S + X\n"
+    "60 IF I < 10 THEN 40\n"
+    "70 PRINT S\n"
+    "80 END\n";
+
+static void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cerr << "execution_test: " << what << std::endl;
+        std::exit(1);
+    }
+}
+
+int main() {
+    int sink = ::open("/dev/null", O_WRONLY);
+    EvalState state(sink);
+    state.useInputQueue();
+    Program program;
+    loadProgramText(PROGRAM, program, state, 1);
+    Execution execution(program, state);
+
+    check(execution.run() == EXEC_WAITING, "run does not wait for INPUT");
+    check(execution.line() == 10, "run waits at the wrong line");
+    check(execution.resume() == EXEC_WAITING, "resume runs without input");
+
+    execution.provideInput("5");
+    int slices = 0;
+    ExecStatus status;
+    while ((status = execution.resumeJumps(3)) == EXEC_SUSPENDED) {
+        check(execution.line() == 40, "slice ends at the wrong line");
+        slices++;
+        check(slices < 10, "program does not end");
+    }
+    check(status == EXEC_DONE, "program does not run to the end");
+    check(slices == 3, "slices of 3 jumps through 9 jumps: " + std::to_string(slices));
+    check(state.getValue("S") == 50, "wrong result");
+
+    ::close(sink);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * File: session_test.cpp
+ * ----------------------
+ * Runs a trace over the socket of a server, as a client typing the
+ * lines would, and compares what comes back with the expected output.
+ *
+ * Usage: session_test BASIC TRACE EXPECTED [CLIENTS]
+ *
+ * BASIC is started with --server on a socket in a fresh temporary
+ * directory.  CLIENTS connections (2 by default) send the whole trace
+ * at once and shut down their side for writing, and each of them must
+ * receive exactly the expected output, which shows that sessions
+ * running side by side do not see each other's variables.  Exits with
+ * a nonzero status and a message if anything differs or fails.
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static pid_t server = -1;
+static std::string directory;
+static std::string socketPath;
+
+static void cleanUp() {
+    if (server > 0) {
+        ::kill(server, SIGTERM);
+        ::waitpid(server, nullptr, 0);
+        server = -1;
+    }
+    ::unlink(socketPath.c_str());
+    ::rmdir(directory.c_str());
+}
+
+static void fail(const std::string &what) {
+    std::cerr << "session_test: " << what << std::endl;
+    cleanUp();
+    std::exit(1);
+}
+
+static std::string readFile(const char *filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) fail(std::string("cannot read ") + filename);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+/*
+ * Implementation notes: connectToServer
+ * -------------------------------------
+ * The server creates its socket some time after it has been started,
+ * so the first attempts may find nothing there yet.
+ */
+
+static int connectToServer() {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof address.sun_path - 1);
+    for (int attempt = 0; attempt < 500; attempt++) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) fail("cannot create socket");
+        if (::connect(fd, (sockaddr *) &address, sizeof address) == 0) return fd;
+        ::close(fd);
+        ::usleep(10000);
+    }
+    fail("server did not start");
+    return -1;
+}
+
+static void sendAll(int fd, const std::string &text) {
+    std::size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t n = ::write(fd, text.data() + sent, text.size() - sent);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("cannot send trace");
+        }
+        sent += std::size_t(n);
+    }
+}
+
+static std::string receiveAll(int fd) {
+    std::string text;
+    char buffer[4096];
+    while (true) {
+        ssize_t n = ::read(fd, buffer, sizeof buffer);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("cannot receive output");
+        }
+        if (n == 0) break;
+        text.append(buffer, std::size_t(n));
+    }
+    return text;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4 || argc > 5) {
+        std::cerr << "usage: session_test BASIC TRACE EXPECTED [CLIENTS]" << std::endl;
+        return 2;
+    }
+    std::string trace = readFile(argv[2]);
+    std::string expected = readFile(argv[3]);
+    int clients = argc == 5 ? std::atoi(argv[4]) : 2;
+    ::signal(SIGPIPE, SIG_IGN);
+
+    char scratch[] = "/tmp/basic-session-XXXXXX";
+    if (::mkdtemp(scratch) == nullptr) fail("cannot create directory");
+    directory = scratch;
+    socketPath = directory + "/socket";
+    std::string option = "--server=" + socketPath;
+    server = ::fork();
+    if (server < 0) fail("cannot start server");
+    if (server == 0) {
+        ::execl(argv[1], argv[1], option.c_str(), "--workers=2", (char *) nullptr);
+        std::_Exit(127);
+    }
+
+    std::vector<int> connections;
+    for (int i = 0; i < clients; i++) connections.push_back(connectToServer());
+    for (int fd : connections) {
+        sendAll(fd, trace);
+        ::shutdown(fd, SHUT_WR);
+    }
+    for (int i = 0; i < clients; i++) {
+        std::string output = receiveAll(connections[i]);
+        ::close(connections[i]);
+        if (output != expected) {
+            std::cerr << "--- client " << i << " received:\n" << output
+                      << "--- expected:\n" << expected;
+            fail("client " + std::to_string(i) + " output differs");
+        }
+    }
+    cleanUp();
+    return 0;
+}
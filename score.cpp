@@ -1,5 +1,17 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <csignal>
 #include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 using namespace std;
@@ -7,6 +19,7 @@ using namespace std;
 const string traceFolder = "Test/";
 const string defaultStudentBasic = "./testcode";
 const string defaultStanderBasic = "./Basic-Demo-64bit";
+const string cacheFolder = ".score_cache/";
 
 const int traceCount = 100;
 const string traces[traceCount] = {
@@ -36,20 +49,32 @@ string studentBasic = "";
 string standerBasic = "";
 string traceFile = "";
 int runTraces = traceCount, currentTrace = 0;
+int jobs = 1;
 bool silent = false, firstFail = false, hideError = false, useColor = true;
+bool useCache = true, refreshCache = false;
+string standerHash = "";
+
+/*
+ * The output of a program that is still writing after this many bytes
+ * is treated like a program that does not stop.
+ */
+const size_t maxOutput = 64 << 20;
 
 int correct = 0, wrong = 0, total = 0;
 
 void usage(const char *progname) {
     cout
-            << progname << " [-h] [-e <your_exec>] [-s <stander_exec>] [-t <trace_file>] [-f] [-m] [-q]" << endl
+            << progname << " [-h] [-e <your_exec>] [-s <stander_exec>] [-t <trace_file>] [-j <n>] [-f] [-m] [-q] [-r] [-n]" << endl
             << "    -h  Show this message and quit" << endl
             << "    -e  Specify your executable file, default value: " << defaultStudentBasic << endl
             << "    -s  Specify demo executable file, default value: " << defaultStanderBasic << endl
             << "    -t  Run specified trace file" << endl
+            << "    -j  Run <n> traces at a time, 0 for one per processor, default value: 1" << endl
             << "    -f  Stop at first failed test" << endl
             << "    -m  Hide error message" << endl
-            << "    -q  Show final score only, cannot use with -t or -f, include -m" << endl;
+            << "    -q  Show final score only, cannot use with -t or -f, include -m" << endl
+            << "    -r  Rerun the demo program and refresh its cached output" << endl
+            << "    -n  Do not use the cache of demo program output in " << cacheFolder << endl;
     exit(1);
 }
 
@@ -61,7 +86,7 @@ string color(string ce) {
 void parseArguments(int argc, char **argv) {
     int c;
     opterr = 0;
-    while ((c = getopt(argc, argv, "e:s:t:fmqch")) != -1) {
+    while ((c = getopt(argc, argv, "e:s:t:j:fmqrnch")) != -1) {
         switch (c) {
             case 'e':
                 if (studentBasic.size()) usage(argv[0]);
@@ -75,6 +100,13 @@ void parseArguments(int argc, char **argv) {
                 if (traceFile.size()) usage(argv[0]);
                 traceFile = optarg;
                 break;
+            case 'j': {
+                char *end;
+                long n = strtol(optarg, &end, 10);
+                if (*end != '\0' || n < 0 || n > 1024) usage(argv[0]);
+                jobs = n ? int(n) : max(1, int(thread::hardware_concurrency()));
+                break;
+            }
             case 'f':
                 if (firstFail) usage(argv[0]);
                 firstFail = true;
@@ -87,6 +119,12 @@ void parseArguments(int argc, char **argv) {
                 if (silent) usage(argv[0]);
                 silent = true;
                 break;
+            case 'r':
+                refreshCache = true;
+                break;
+            case 'n':
+                useCache = false;
+                break;
             case 'h':
                 usage(argv[0]);
                 break;
@@ -101,34 +139,235 @@ void parseArguments(int argc, char **argv) {
     if (standerBasic.size() == 0) standerBasic = defaultStanderBasic;
 }
 
-void clearTempFiles() {
-    int r = system("rm test_ans test_out -f");
-    (void) r;
+/*
+ * Function: readFile
+ * ------------------
+ * Reads a whole trace file into memory.
+ */
+
+bool readFile(const string &name, string &text) {
+    ifstream in(name, ios::binary);
+    if (!in) return false;
+    ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+/*
+ * Function: hashText
+ * ------------------
+ * Returns the 64-bit FNV-1a hash of text, combined with its length, as
+ * a string of hex digits.
+ */
+
+string hashText(const string &text) {
+    unsigned long long hash = 14695981039346656037ull;
+    for (unsigned char ch : text) {
+        hash ^= ch;
+        hash *= 1099511628211ull;
+    }
+    char digits[48];
+    snprintf(digits, sizeof digits, "%016llx%08zx", hash, text.size());
+    return digits;
+}
+
+/*
+ * Functions: readCache, writeCache
+ * --------------------------------
+ * The demo program's output for a trace is cached in cacheFolder under
+ * a name made from the hash of the demo executable and the hash of the
+ * trace, so a cached answer is used only for exactly the same program
+ * and input.  An entry is written to a temporary file and renamed into
+ * place, so concurrent workers and interrupted runs never leave a
+ * partial entry behind.
+ */
+
+string cacheName(const string &input) {
+    return cacheFolder + standerHash + "-" + hashText(input);
 }
 
-int testTrace(const char *trace) {
-    clearTempFiles();
-    if (system((string() + "cat " + trace + " | timeout 1 " + standerBasic + " > test_ans 2> /dev/null").c_str()) !=
-        0)
-        return 1;
-    if (system((string() + "cat " + trace + " | timeout 1 " + studentBasic + " > test_out 2> /dev/null").c_str()) !=
-        0)
-        return 2;
-    if (system("diff test_ans test_out > /dev/null 2> /dev/null")) return 4;
-    if (system(
-            (string() + "cat " + trace + " | timeout 5 valgrind --error-exitcode=2 --leak-check=full " + studentBasic +
-             " > /dev/null 2> /dev/null").c_str()) != 0)
+bool readCache(const string &input, string &expected) {
+    if (!useCache || refreshCache || standerHash.empty()) return false;
+    return readFile(cacheName(input), expected);
+}
+
+void writeCache(const string &input, const string &expected) {
+    if (!useCache || standerHash.empty()) return;
+    static atomic<int> counter(0);
+    string name = cacheName(input);
+    string temp = name + ".tmp" + to_string(getpid()) + "-" + to_string(counter++);
+    {
+        ofstream out(temp, ios::binary);
+        out << expected;
+        if (!out) {
+            out.close();
+            unlink(temp.c_str());
+            return;
+        }
+    }
+    if (rename(temp.c_str(), name.c_str()) != 0) unlink(temp.c_str());
+}
+
+/*
+ * Function: initCache
+ * -------------------
+ * Hashes the demo executable and makes sure the cache folder exists.
+ * If either fails, the cache is simply not used.
+ */
+
+void initCache() {
+    if (!useCache) return;
+    string binary;
+    if (!readFile(standerBasic, binary)) return;
+    mkdir(cacheFolder.c_str(), 0777);
+    struct stat st;
+    if (stat(cacheFolder.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return;
+    standerHash = hashText(binary);
+}
+
+/*
+ * Function: runProcess
+ * --------------------
+ * Runs args[0] with the given arguments, feeding it input on stdin and
+ * collecting its stdout in output; stderr is discarded.  The child is
+ * killed if it is still running after timeout seconds.  Returns the
+ * exit status as system() would report it through timeout(1): 0 on
+ * success, 124 on timeout, 127 if the program cannot be started.
+ *
+ * The pipes are created close-on-exec so that a child started by one
+ * worker thread does not inherit the pipes of another worker's child,
+ * which would keep that child's output from ever reaching end of file.
+ */
+
+int runProcess(const vector<string> &args, const string &input, int timeout, string &output) {
+    output.clear();
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) != 0) return 127;
+    if (pipe2(out, O_CLOEXEC) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return 127;
+    }
+    vector<char *> argv;
+    for (const string &arg : args) argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        if (devnull >= 0) dup2(devnull, 2);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        return 127;
+    }
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+    size_t written = 0;
+    int inFd = in[1];
+    if (input.empty()) {
+        close(inFd);
+        inFd = -1;
+    }
+    bool killed = false;
+    char buffer[65536];
+    while (true) {
+        pollfd fds[2];
+        int nfds = 0;
+        fds[nfds++] = {out[0], POLLIN, 0};
+        if (inFd >= 0) fds[nfds++] = {inFd, POLLOUT, 0};
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        int wait = killed ? -1 : int(max<long long>(0, left.count()));
+        int ready = poll(fds, nfds, wait);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ready == 0 || (!killed && output.size() > maxOutput)) {
+            kill(pid, SIGKILL);
+            killed = true;
+            if (inFd >= 0) {
+                close(inFd);
+                inFd = -1;
+            }
+            continue;
+        }
+        if (nfds > 1 && fds[1].revents != 0) {
+            ssize_t n = write(inFd, input.data() + written, input.size() - written);
+            if (n > 0) written += size_t(n);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) written = input.size();
+            if (written == input.size()) {
+                close(inFd);
+                inFd = -1;
+            }
+        }
+        if (fds[0].revents != 0) {
+            ssize_t n = read(out[0], buffer, sizeof buffer);
+            if (n > 0) {
+                if (!killed) output.append(buffer, size_t(n));
+            } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                break;
+            }
+        }
+    }
+    if (inFd >= 0) close(inFd);
+    close(out[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (killed) return 124;
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status);
+}
+
+/*
+ * Type: TraceResult
+ * -----------------
+ * The outcome of one trace: the error code returned by testTrace and,
+ * for reporting a failure, the trace and both programs' output.
+ */
+
+struct TraceResult {
+    string trace;
+    int error = 0;
+    string input, expected, actual;
+};
+
+/*
+ * Function: testTrace
+ * -------------------
+ * Runs one trace through the demo program (unless its output is in the
+ * cache) and the program under test, compares their output and checks the program under test for memory
+ * errors.  Output is kept in memory, so any number of traces can be
+ * tested at the same time.
+ */
+
+int testTrace(TraceResult &result) {
+    if (!readFile(result.trace, result.input)) return 1;
+    if (!readCache(result.input, result.expected)) {
+        if (runProcess({standerBasic}, result.input, 1, result.expected) != 0) return 1;
+        writeCache(result.input, result.expected);
+    }
+    if (runProcess({studentBasic}, result.input, 1, result.actual) != 0) return 2;
+    if (result.expected != result.actual) return 4;
+    string ignored;
+    if (runProcess({"valgrind", "--error-exitcode=2", "--leak-check=full", studentBasic},
+                   result.input, 5, ignored) != 0)
         return 3;
-    clearTempFiles();
     return 0;
 }
 
-void runTest(const string currentTrace) {
-    if (!silent) cout << "Trace \"" << currentTrace << "\" ... ";
-    cout.flush();
-    int error = testTrace(currentTrace.c_str());
+void reportTrace(const TraceResult &result, bool announce) {
+    if (!silent && announce) cout << "Trace \"" << result.trace << "\" ... ";
     total++;
-    if (!error) {
+    if (!result.error) {
         if (!silent) cout << color("\x1b[32;1m") << "Pass" << color("\x1b[0m") << endl;
         correct++;
     } else {
@@ -136,37 +375,66 @@ void runTest(const string currentTrace) {
         if (!silent) {
             cout << color("\x1b[31;1m") << "Fail" << color("\x1b[0m") << endl;
             if (!hideError) {
-                cout << "Trace file: " << endl << color("\x1b[35m");
-                cout.flush();
-                int r0 = system((string() + "cat " + currentTrace).c_str());
-                (void) r0;
+                cout << "Trace file: " << endl << color("\x1b[35m") << result.input;
                 cout << color("\x1b[0m") << endl;
-                if (error == 1)
+                if (result.error == 1)
                     cout << color("\x1b[31m") << "Error occurred while running demo program" << color("\x1b[0m")
                          << endl;
-                if (error == 2)
+                if (result.error == 2)
                     cout << color("\x1b[31m") << "Error occurred while running your program" << color("\x1b[0m")
                          << endl;
-                if (error == 3) cout << color("\x1b[31m") << "Memory leak" << color("\x1b[0m") << endl;
-                if (error == 4) {
-                    cout << "Demo output: " << endl << color("\x1b[36m");
-                    cout.flush();
-                    int r1 = system("cat test_ans");
-                    (void) r1;
+                if (result.error == 3) cout << color("\x1b[31m") << "Memory leak" << color("\x1b[0m") << endl;
+                if (result.error == 4) {
+                    cout << "Demo output: " << endl << color("\x1b[36m") << result.expected;
                     cout << color("\x1b[0m") << endl;
-                    cout << "Your output: " << endl << color("\x1b[33m");
-                    cout.flush();
-                    int r2 = system("cat test_out");
-                    (void) r2;
+                    cout << "Your output: " << endl << color("\x1b[33m") << result.actual;
                     cout << color("\x1b[0m") << endl;
                 }
             }
         }
-        clearTempFiles();
         if (firstFail) throw exception();
     }
 }
 
+/*
+ * Function: runTests
+ * ------------------
+ * Tests the traces on a pool of jobs worker threads, each of which
+ * claims the next untested trace until none are left, and reports the
+ * results in trace order.  With -f, workers stop claiming traces once
+ * one has failed; every trace before the first failure has already
+ * been claimed by then, so the report is the same as a serial run's.
+ */
+
+void runTests(const vector<string> &names) {
+    vector<TraceResult> results(names.size());
+    for (size_t i = 0; i < names.size(); i++) results[i].trace = names[i];
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+    auto work = [&]() {
+        while (!(firstFail && failed)) {
+            size_t i = next++;
+            if (i >= results.size()) break;
+            results[i].error = testTrace(results[i]);
+            if (results[i].error) failed = true;
+        }
+    };
+    int workers = max(1, min(jobs, int(names.size())));
+    if (workers == 1) {
+        for (TraceResult &result : results) {
+            if (!silent) cout << "Trace \"" << result.trace << "\" ... ";
+            cout.flush();
+            result.error = testTrace(result);
+            reportTrace(result, false);
+        }
+        return;
+    }
+    vector<thread> pool;
+    for (int i = 0; i < workers; i++) pool.emplace_back(work);
+    for (thread &worker : pool) worker.join();
+    for (size_t i = 0; i < next && i < results.size(); i++) reportTrace(results[i], true);
+}
+
 void showScore() {
     int score = correct / 5 * 5;
     if (!silent)
@@ -177,17 +445,21 @@ void showScore() {
 
 int main(int argc, char **argv) {
     parseArguments(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    initCache();
     try {
         cout << "Compiling code ..." << endl;
         /**************************************************************
          if you modify the structure of the files, you should modify the file paths here.
          **************************************************************/
-        system("g++ -o testcode Basic/Basic.cpp Basic/evalstate.cpp Basic/exp.cpp Basic/parser.cpp Basic/program.cpp Basic/statement.cpp Basic/Utils/error.cpp Basic/Utils/error.hpp Basic/Utils/tokenScanner.cpp Basic/Utils/tokenScanner.hpp Basic/Utils/strlib.cpp");
-         if (traceFile.size()) runTest(traceFile);
+        system("g++ -pthread -o testcode Basic/Basic.cpp Basic/allocstats.cpp Basic/arena.cpp Basic/bytecode.cpp Basic/evalstate.cpp Basic/execution.cpp Basic/exp.cpp Basic/image.cpp Basic/jit.cpp Basic/loader.cpp Basic/optimizer.cpp Basic/output.cpp Basic/parser.cpp Basic/profiler.cpp Basic/program.cpp Basic/server.cpp Basic/session.cpp Basic/statement.cpp Basic/threaded.cpp Basic/value.cpp Basic/Utils/error.cpp Basic/Utils/error.hpp Basic/Utils/tokenScanner.cpp Basic/Utils/tokenScanner.hpp Basic/Utils/strlib.cpp");
+         vector<string> names;
+         if (traceFile.size()) names.push_back(traceFile);
          else {
              int i = 0;
-             for (; i < traceCount; i++) runTest(traceFolder + traces[i]);
+             for (; i < traceCount; i++) names.push_back(traceFolder + traces[i]);
          }
+         runTests(names);
     } catch (...) {}
     system("rm testcode -f");
     showScore();